@@ -0,0 +1,69 @@
+// File: bench.c
+// Subject: IZP
+// Project: #2
+// Author: Andrii Klymenko, FIT VUT
+// Login: xklyme00
+// Date: 22.7.2023
+
+// measures the phases of one run of the program: loading of the file, clustering and printing of the clusters
+// cluster.c is compiled into this file, so the phases run the same functions as the program does
+//   gcc -std=c99 -Wall -Wextra -Werror -O2 -DNDEBUG bench/bench.c -o bench -lm -lpthread
+// usage: the same as the program (./bench SOUBOR [N] [flag] [options]), the clusters are printed to stdout
+// and the times of the phases (seconds of the wall-clock time) are printed to stderr as one JSON object:
+//   {"objects":N,"load":T,"cluster":T,"output":T,"total":T}
+
+#define CLUSTER_LIBRARY  // main of the program is left out
+
+#include "../cluster.c"
+
+int main(int argc, char *argv[])
+{
+    arguments_t a = {.required_clusters = 1, .flag = 's', .seed = (unsigned long long) time(NULL), .threads = 1,
+                     .format = 't'}; // program arguments
+
+    if(!parseArguments(argc, argv, &a))
+        return -1;
+
+    // only the runs that make one clustering have these three phases
+    if(a.output != NULL || a.insert || a.cut_count > 0)
+    {
+        fprintf(stderr, "Error! Benchmark can't run 'convert', 'insert' or '--cuts'\n");
+        return -1;
+    }
+
+    cluster_context_t *ctx = clusterCreate(a.threads);
+
+    if(ctx == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't start %d threads\n", a.threads);
+        return -1;
+    }
+
+    double start = wallTime();
+    int arr_size = load_clusters(&ctx->clusters, &ctx->objects, &a);
+    double loaded = wallTime();
+
+    if(arr_size == -1)
+    {
+        clusterDestroy(ctx);
+        return -1;
+    }
+
+    ctx->size = arr_size;
+    ctx->cluster_capacity = a.required_clusters;
+
+    int result = finalClustering(ctx, &arr_size, &a);
+    double clustered = wallTime();
+
+    if(result == 0)
+        result = writeClusters(ctx->clusters, arr_size, a.format) ? 0 : -1;
+
+    double printed = wallTime();
+
+    if(result == 0)
+        fprintf(stderr, "{\"objects\":%d,\"load\":%.6f,\"cluster\":%.6f,\"output\":%.6f,\"total\":%.6f}\n", ctx->size,
+                loaded - start, clustered - loaded, printed - clustered, printed - start);
+
+    clusterDestroy(ctx);
+    return result;
+}
@@ -0,0 +1,152 @@
+// File: generate.c
+// Subject: IZP
+// Project: #2
+// Author: Andrii Klymenko, FIT VUT
+// Login: xklyme00
+// Date: 22.7.2023
+
+// generator of the synthetic input files for the benchmark (format of the program: "count=N" and "OBJID X Y" lines)
+//   gcc -std=c99 -Wall -Wextra -Werror -O2 bench/generate.c -o generate -lm
+// usage: ./generate KIND COUNT [SEED]
+// kinds:
+//   uniform - objects are spread evenly over the whole area
+//   blobs - objects are around 10 random centers (normal distribution)
+//   duplicates - objects are only in COUNT / 20 different places, most of them have the same coordinates
+//   line - objects are close to one random line
+// the same arguments always generate the same file
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+
+#define BLOB_NUMBER 10  // number of the centers of the blobs
+#define BLOB_DEVIATION 30.0  // standard deviation of the distance from the center of the blob
+#define DUPLICATE_RATIO 20  // average number of the objects in one place (duplicates)
+#define LINE_DEVIATION 3.0  // maximum distance from the line
+#define PI 3.14159265358979323846
+
+// state of the random number generator (splitmix64, the same as in the program)
+typedef struct random_t {
+    uint64_t state;
+} random_t;
+
+uint64_t nextRandom(random_t *r)
+{
+    uint64_t z = (r->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// returns a random number from the interval [0, 1)
+double randomDouble(random_t *r)
+{
+    return (nextRandom(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// returns a random number of the normal distribution (Box-Muller transform)
+double randomNormal(random_t *r)
+{
+    return sqrt(-2.0 * log(1.0 - randomDouble(r))) * cos(2.0 * PI * randomDouble(r));
+}
+
+// returns a random integer coordinate from the interval [0, 1000]
+int randomCoordinate(random_t *r)
+{
+    return (int) (randomDouble(r) * 1001.0);
+}
+
+// rounds the number to the nearest coordinate from the interval [0, 1000]
+int toCoordinate(double number)
+{
+    return number < 0.0 ? 0 : number > 1000.0 ? 1000 : (int) lround(number);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3 || argc > 4)
+    {
+        fprintf(stderr, "Error! Usage: %s uniform|blobs|duplicates|line COUNT [SEED]\n", argv[0]);
+        return -1;
+    }
+
+    char *end_ptr;
+    long long count = strtoll(argv[2], &end_ptr, 10);
+
+    if(*argv[2] == '\0' || *end_ptr != '\0' || count < 1 || count > INT_MAX)
+    {
+        fprintf(stderr, "Error! Number of the objects must be an integer from the interval [1, %d]\n", INT_MAX);
+        return -1;
+    }
+
+    random_t r = {.state = argc == 4 ? strtoull(argv[3], NULL, 10) : 1};
+    char *kind = argv[1];
+
+    if(strcmp(kind, "uniform") != 0 && strcmp(kind, "blobs") != 0 && strcmp(kind, "duplicates") != 0 &&
+       strcmp(kind, "line") != 0)
+    {
+        fprintf(stderr, "Error! Unknown kind of the objects '%s'\n", kind);
+        return -1;
+    }
+
+    // centers of the blobs/places of the duplicates
+    int places = strcmp(kind, "duplicates") == 0 ? (int) (count / DUPLICATE_RATIO) + 1 : BLOB_NUMBER;
+    int *place_x = (int *) malloc(sizeof(int) * places);
+    int *place_y = (int *) malloc(sizeof(int) * places);
+
+    if(place_x == NULL || place_y == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the places of the objects\n");
+        free(place_x);
+        free(place_y);
+        return -1;
+    }
+
+    for(int i = 0; i < places; i++)
+    {
+        place_x[i] = randomCoordinate(&r);
+        place_y[i] = randomCoordinate(&r);
+    }
+
+    // line from the point [0, y0] to the point [1000, y1]
+    double y0 = randomCoordinate(&r), y1 = randomCoordinate(&r);
+
+    printf("count=%lld\n", count);
+
+    for(long long i = 0; i < count; i++)
+    {
+        int x, y;
+
+        if(strcmp(kind, "uniform") == 0)
+        {
+            x = randomCoordinate(&r);
+            y = randomCoordinate(&r);
+        }
+        else if(strcmp(kind, "blobs") == 0)
+        {
+            int blob = (int) (nextRandom(&r) % places);
+            x = toCoordinate(place_x[blob] + BLOB_DEVIATION * randomNormal(&r));
+            y = toCoordinate(place_y[blob] + BLOB_DEVIATION * randomNormal(&r));
+        }
+        else if(strcmp(kind, "duplicates") == 0)
+        {
+            int place = (int) (nextRandom(&r) % places);
+            x = place_x[place];
+            y = place_y[place];
+        }
+        else
+        {
+            x = randomCoordinate(&r);
+            y = toCoordinate(y0 + (y1 - y0) * x / 1000.0 + LINE_DEVIATION * (2.0 * randomDouble(&r) - 1.0));
+        }
+
+        printf("%lld %d %d\n", i + 1, x, y);
+    }
+
+    free(place_x);
+    free(place_y);
+    return 0;
+}
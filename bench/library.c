@@ -0,0 +1,97 @@
+// File: library.c
+// Subject: IZP
+// Project: #2
+// Author: Andrii Klymenko, FIT VUT
+// Login: xklyme00
+// Date: 22.7.2023
+
+// runs the clustering through the library interface (cluster.h), all runs use one context, so every run after
+// the first one reuses the buffers and the scratch memory of the previous runs
+//   gcc -std=c99 -Wall -Wextra -Werror -O2 -I. bench/library.c -o library -L. -lcluster -lm -lpthread
+// usage: ./library FILE SEED THREADS RUN...
+//   FILE - input file of the program (text format)
+//   RUN - 'METHOD,N', e.g. 'a,10' (METHOD is s, c, a, w, m or k, see clusterRun)
+// prints the labels of every run the same way as './cluster FILE N -METHOD --format csv' prints them
+// ('id,cluster' header and one line per object), the objects are in the order of the file
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cluster.h"
+
+// reads the objects of the text file, returns their number (-1 on error)
+int readPoints(char *filename, int **ids, float **x, float **y)
+{
+    FILE *f = fopen(filename, "r");
+    int count;
+
+    if(f == NULL || fscanf(f, "count=%d", &count) != 1 || count < 1)
+    {
+        fprintf(stderr, "Error! Couldn't read the file '%s'\n", filename);
+
+        if(f != NULL)
+            fclose(f);
+
+        return -1;
+    }
+
+    *ids = (int *) malloc(sizeof(int) * count);
+    *x = (float *) malloc(sizeof(float) * count);
+    *y = (float *) malloc(sizeof(float) * count);
+    int i = 0;
+
+    while(*ids != NULL && *x != NULL && *y != NULL && i < count &&
+          fscanf(f, "%d %f %f", &(*ids)[i], &(*x)[i], &(*y)[i]) == 3)
+        i++;
+
+    fclose(f);
+
+    if(i < count)
+    {
+        fprintf(stderr, "Error! Couldn't read the objects of the file '%s'\n", filename);
+        return -1;
+    }
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 5)
+    {
+        fprintf(stderr, "Error! Invalid number of the program arguments\n");
+        return 1;
+    }
+
+    int *ids = NULL;
+    float *x = NULL, *y = NULL;
+    int count = readPoints(argv[1], &ids, &x, &y);
+    cluster_context_t *ctx = count > 0 ? clusterCreate(atoi(argv[3])) : NULL;
+    int result = ctx != NULL && clusterSetPoints(ctx, x, y, count) ? 0 : 1;
+
+    for(int i = 4; i < argc && result == 0; i++)
+    {
+        char method;
+        int clusters;
+
+        if(sscanf(argv[i], "%c,%d", &method, &clusters) != 2 ||
+           !clusterRun(ctx, method, clusters, strtoull(argv[2], NULL, 10)))
+        {
+            fprintf(stderr, "Error! Run '%s' failed\n", argv[i]);
+            result = 1;
+            break;
+        }
+
+        const int *labels = clusterLabels(ctx);
+        printf("id,cluster\n");
+
+        for(int j = 0; j < count; j++)
+            printf("%d,%d\n", ids[j], labels[j]);
+    }
+
+    clusterDestroy(ctx);
+    free(ids);
+    free(x);
+    free(y);
+    return result;
+}
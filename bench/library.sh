@@ -0,0 +1,88 @@
+#!/bin/sh
+# builds the shared library (libcluster.so) and checks it on the generated datasets:
+# only the functions of cluster.h are exported and every run of one context (see library.c) prints the same clusters
+# as the program run with the same arguments
+# usage: bench/library.sh
+# environment variables:
+#   KINDS - kinds of the datasets (default "uniform blobs duplicates line", see generate.c)
+#   SIZE - number of the objects (default 300)
+#   CLUSTERS - number of the clusters, the runs alternate it with 2 * CLUSTERS (default 10)
+#   SEED - seed of the datasets and k-means (default 1)
+#   THREADS - number of the threads (default 2)
+# prints one line per dataset and exits with 1 if any check failed
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+KINDS=${KINDS:-"uniform blobs duplicates line"}
+SIZE=${SIZE:-300}
+CLUSTERS=${CLUSTERS:-10}
+SEED=${SEED:-1}
+THREADS=${THREADS:-2}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CFLAGS="-std=c99 -Wall -Wextra -Werror -O2 -DNDEBUG"
+
+gcc $CFLAGS -DCLUSTER_LIBRARY -fPIC -shared "$ROOT/cluster.c" -o "$WORK/libcluster.so" -lm -lpthread
+gcc $CFLAGS -I"$ROOT" "$ROOT/bench/library.c" -o "$WORK/library" -L"$WORK" -Wl,-rpath,"$WORK" -lcluster -lm -lpthread
+gcc $CFLAGS "$ROOT/bench/generate.c" -o "$WORK/generate" -lm
+gcc $CFLAGS "$ROOT/cluster.c" -o "$WORK/cluster" -lm -lpthread
+
+failed=0
+
+exported=$(nm -D --defined-only "$WORK/libcluster.so" | awk '{print $3}' | sort | tr '\n' ' ')
+
+if [ "$exported" = "clusterCreate clusterDestroy clusterLabels clusterRun clusterSetPoints " ]; then
+    echo "exported symbols: ok"
+else
+    echo "exported symbols: $exported"
+    failed=1
+fi
+
+# every method twice with different numbers of the clusters, so the buffers of the context are reused
+# for smaller and bigger runs and for the runs of the other methods
+RUNS=""
+
+for n in $CLUSTERS $((CLUSTERS * 2)); do
+    for method in s c a w m k; do
+        RUNS="$RUNS $method,$n"
+    done
+done
+
+RUNS="$RUNS $(echo "$RUNS" | tr ' ' '\n' | sort -r | tr '\n' ' ')"
+
+for kind in $KINDS; do
+    "$WORK/generate" "$kind" "$SIZE" "$SEED" > "$WORK/input"
+
+    if ! "$WORK/library" "$WORK/input" "$SEED" "$THREADS" $RUNS > "$WORK/labels"; then
+        echo "$kind $SIZE: library failed"
+        failed=1
+        continue
+    fi
+
+    result="ok"
+    run=0
+
+    for r in $RUNS; do
+        run=$((run + 1))
+        method=${r%,*}
+        n=${r#*,}
+
+        # labels of the run 'run' are between its header and the next one
+        awk -v run="$run" '/^id,cluster$/ {count++; next} count == run' "$WORK/labels" | sort > "$WORK/actual"
+        "$WORK/cluster" "$WORK/input" "$n" "-$method" --seed "$SEED" --threads "$THREADS" --format csv |
+            tail -n +2 | sort > "$WORK/expected"
+
+        if ! cmp -s "$WORK/actual" "$WORK/expected"; then
+            result="run $run ($r) differs from the program"
+            failed=1
+            break
+        fi
+    done
+
+    echo "$kind $SIZE: $result"
+done
+
+exit $failed
@@ -0,0 +1,104 @@
+#!/bin/sh
+# checks the linkage matrix of average linkage ('-a --linkage') on the generated datasets
+# every row 'C1 C2 DISTANCE SIZE' must join two existing clusters, SIZE must be the size of the new cluster
+# and DISTANCE must be the average distance between the objects of C1 and C2 computed from the input
+# usage: bench/linkage.sh
+# environment variables:
+#   KINDS - kinds of the datasets (default "uniform blobs duplicates line", see generate.c)
+#   SIZES - numbers of the objects (default "2 50 300")
+#   SEED - seed of the datasets (default 1)
+# prints one line per dataset and exits with 1 if any row is wrong
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+KINDS=${KINDS:-"uniform blobs duplicates line"}
+SIZES=${SIZES:-"2 50 300"}
+SEED=${SEED:-1}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CFLAGS="-std=c99 -Wall -Wextra -Werror -O2 -DNDEBUG"
+
+gcc $CFLAGS "$ROOT/bench/generate.c" -o "$WORK/generate" -lm
+gcc $CFLAGS "$ROOT/cluster.c" -o "$WORK/cluster" -lm -lpthread
+
+failed=0
+
+for kind in $KINDS; do
+    for size in $SIZES; do
+        "$WORK/generate" "$kind" "$size" "$SEED" > "$WORK/input"
+        "$WORK/cluster" "$WORK/input" 1 -a --linkage "$WORK/linkage" > /dev/null
+
+        # clusters 0 .. n - 1 are the objects in the order of the input file, row i makes the cluster n + i
+        if awk '
+            NR == FNR {
+                if(FNR > 1)
+                {
+                    x[FNR - 2] = $2
+                    y[FNR - 2] = $3
+                    members[FNR - 2] = FNR - 2
+                    count[FNR - 2] = 1
+                    n = FNR - 1
+                }
+                next
+            }
+            {
+                row = FNR - 1
+                a = $1
+                b = $2
+
+                if(!(a in count) || !(b in count) || a == b || $4 != count[a] + count[b])
+                {
+                    printf "row %d: invalid clusters or size: %s\n", row, $0
+                    bad = 1
+                    exit
+                }
+
+                split(members[a], ma, " ")
+                split(members[b], mb, " ")
+                sum = 0
+
+                for(i = 1; i <= count[a]; i++)
+                    for(j = 1; j <= count[b]; j++)
+                        sum += sqrt((x[ma[i]] - x[mb[j]]) ^ 2 + (y[ma[i]] - y[mb[j]]) ^ 2)
+
+                expected = sum / (count[a] * count[b])
+                difference = $3 - expected
+
+                if(difference < 0)
+                    difference = -difference
+
+                # distances are floats, the average of the distances up to 1000 * sqrt(2) is rounded a few times
+                if(difference > 1e-3 + 1e-5 * expected)
+                {
+                    printf "row %d: distance %s, expected %.9g\n", row, $3, expected
+                    bad = 1
+                    exit
+                }
+
+                members[n + row] = members[a] " " members[b]
+                count[n + row] = count[a] + count[b]
+                delete count[a]
+                delete count[b]
+                rows++
+            }
+            END {
+                if(!bad && rows != n - 1)
+                {
+                    printf "%d rows, expected %d\n", rows, n - 1
+                    bad = 1
+                }
+
+                exit bad
+            }' "$WORK/input" "$WORK/linkage" > "$WORK/result"; then
+            echo "$kind $size: ok"
+        else
+            echo "$kind $size: $(cat "$WORK/result")"
+            failed=1
+        fi
+    done
+done
+
+exit $failed
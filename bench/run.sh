@@ -0,0 +1,88 @@
+#!/bin/sh
+# benchmark of all clustering methods on the generated datasets
+# usage: bench/run.sh REF
+#   REF - git revision of the reference implementation the results are compared with (e.g. the merge-base
+#         with the main branch), the benchmark itself uses cluster.c of the working tree
+# environment variables:
+#   KINDS - kinds of the datasets (default "uniform blobs duplicates line", see generate.c)
+#   SIZES - numbers of the objects (default "100 1000 10000"), sizes over 10000 run in the large-input mode
+#   METHODS - clustering methods (default "s c a w m k")
+#   CLUSTERS - number of the clusters (default 10)
+#   SEED - seed of the datasets and k-means (default 1)
+#   THREADS - number of the threads (default 1)
+#   REF_MAX_SIZE - largest size the hierarchical methods of the reference run on (default 1000), an old reference
+#                  searches the nearest clusters in O(n^3), 10000 objects would take hours
+# prints one JSON object per run to stdout, 'match' is true if the reference printed the same clusters
+# (null if the reference wasn't run):
+#   {"kind":"blobs","size":1000,"method":"s","objects":1000,"load":T,"cluster":T,"output":T,"total":T,"match":true}
+
+set -e
+
+if [ $# -ne 1 ]; then
+    echo "usage: bench/run.sh REF" >&2
+    exit 1
+fi
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+REF=$1
+KINDS=${KINDS:-"uniform blobs duplicates line"}
+SIZES=${SIZES:-"100 1000 10000"}
+METHODS=${METHODS:-"s c a w m k"}
+CLUSTERS=${CLUSTERS:-10}
+SEED=${SEED:-1}
+THREADS=${THREADS:-1}
+REF_MAX_SIZE=${REF_MAX_SIZE:-1000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CFLAGS="-std=c99 -Wall -Wextra -Werror -O2 -DNDEBUG"
+
+gcc $CFLAGS "$ROOT/bench/generate.c" -o "$WORK/generate" -lm
+gcc $CFLAGS "$ROOT/bench/bench.c" -o "$WORK/bench" -lm -lpthread
+
+# the reference is built without the warnings, older revisions don't compile with -Werror at -O2
+# (and they have no cluster.h)
+mkdir "$WORK/ref"
+git -C "$ROOT" show "$REF:cluster.c" > "$WORK/ref/cluster.c"
+git -C "$ROOT" show "$REF:cluster.h" > "$WORK/ref/cluster.h" 2> /dev/null || true
+gcc -std=c99 -O2 -DNDEBUG "$WORK/ref/cluster.c" -o "$WORK/reference" -lm -lpthread
+
+for kind in $KINDS; do
+    for size in $SIZES; do
+        "$WORK/generate" "$kind" "$size" "$SEED" > "$WORK/input"
+
+        # options are given only when they are needed, so older revisions can be the reference too
+        options=""
+
+        if [ "$THREADS" -ne 1 ]; then
+            options="--threads $THREADS"
+        fi
+
+        if [ "$size" -gt 10000 ]; then
+            options="$options --memory 65536"
+        fi
+
+        for method in $METHODS; do
+            if [ "$method" = k ]; then
+                method_options="$options --seed $SEED"
+            else
+                method_options="$options"
+            fi
+
+            "$WORK/bench" "$WORK/input" "$CLUSTERS" "-$method" $method_options > "$WORK/output" 2> "$WORK/times"
+
+            if [ "$method" != k ] && [ "$size" -gt "$REF_MAX_SIZE" ]; then
+                match=null
+            elif "$WORK/reference" "$WORK/input" "$CLUSTERS" "-$method" $method_options > "$WORK/expected" 2> /dev/null &&
+                 cmp -s "$WORK/output" "$WORK/expected"; then
+                match=true
+            else
+                match=false
+            fi
+
+            printf '{"kind":"%s","size":%s,"method":"%s",%s,"match":%s}\n' "$kind" "$size" "$method" \
+                "$(sed 's/^{//; s/}$//' "$WORK/times")" "$match"
+        done
+    done
+done
@@ -11,6 +11,8 @@
  * Jednoducha shlukova analyza: 2D nejblizsi soused.
  * Single linkage
  */
+#define _POSIX_C_SOURCE 200809L  // clock_gettime and getrusage ('--stats')
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,6 +20,22 @@
 #include <stdbool.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>  // part of libc since glibc 2.34, older libraries need -pthread
+#include <sys/resource.h>  // getrusage
+
+#ifdef __SSE2__  // always available on x86-64
+#include <emmintrin.h>
+#endif
+
+#include "cluster.h"
+
+// the library exports only the functions of cluster.h (CLUSTER_API), internal names like init or readLine are hidden
+#if defined(CLUSTER_LIBRARY) && defined(__GNUC__)
+#pragma GCC visibility push(hidden)
+#endif
 
 /*****************************************************************
  * Ladici makra. Vypnout jejich efekt lze definici makra
@@ -51,10 +69,34 @@
 #define MAX_CLUSTER_NUMBER 10000  // maximum number of clusters that can be processed by the program
 #define MAX_LINE_LENGTH 15  // in the case when the line is "10000 1000 1000"
 #define MAX_LINE_BUFFER_LENGTH MAX_LINE_LENGTH + 2  // + '\n' + '\0'
+#define MAX_LARGE_LINE_LENGTH 20  // in the case when the line is "2147483647 1000 1000" (large-input mode)
+#define MAX_LARGE_LINE_BUFFER_LENGTH MAX_LARGE_LINE_LENGTH + 2  // + '\n' + '\0'
 #define DELIMITER_CHAR ' '  // space is a delimiter
 #define DELIMITER_STRING " "  // space is a delimiter (for strtok function)
+#define READ_BLOCK_SIZE 65536  // number of the bytes read from the file at once
+#define WRITE_BLOCK_SIZE 65536  // number of the bytes written to the output at once
+#define MEBIBYTE 1048576.0  // number of the bytes in one MiB
+#define BINARY_MAGIC "CLST"  // first bytes of the binary input file
+#define BINARY_VERSION 1  // version of the binary input file format
+#define BINARY_FLOAT32 0  // coordinates in the binary file are 32-bit floats
+#define LABELS_MAGIC "CLSL"  // first bytes of the binary output file of the labels
+#define LABELS_VERSION 1  // version of the binary output file of the labels
+#define STATE_MAGIC "CLSS"  // first bytes of the state file ('--save-state')
+#define STATE_VERSION 1  // version of the state file format
+#define STATE_SIDE 1001  // number of the positions in one row of the table of the positions (coordinates 0 to 1000)
 #define MAX_CLUSTER_DISTANCE 1414.21356 + 1.0  // in the case when first objects has [0, 0] coordinates and second objects has [1000, 1000] coordinates + 1
 #define MIN_CLUSTER_DISTANCE 0.0 - 1.0  // in the case when two objects have the same coordinates - 1
+#define GRID_SIZE 1001.0  // width/height of the area covered by the grid (coordinates are from the interval [0, 1000])
+#define GRID_OBJECTS_PER_CELL 2  // average number of the objects in one cell of the grid
+#define GRID_EPSILON 0.01  // tolerance for the rounding of the distances when the cells are searched
+#define MAX_THREADS 256  // maximum number of the threads
+#define BOUND_EPSILON 0.001  // tolerance for the rounding of the distances in the bounds of k-means
+#define AVERAGE_EPSILON 0.0001  // relative tolerance of the cached average linkage distances that are computed again
+#define MAX_CUTS 100  // maximum number of the cuts in '--cuts'
+#define SCRATCH_BLOCKS 64  // maximum number of the temporary arrays of one run that the library context keeps
+#define MINIBATCH_ITERATIONS 100  // default number of the iterations of mini-batch k-means
+#define KMEANS_ITERATIONS 300  // default maximum number of the iterations of k-means
+#define PHASE_COUNT 6  // number of the phases measured by '--stats'
 
 /*****************************************************************
  * Deklarace potrebnych datovych typu:
@@ -82,17 +124,517 @@ typedef struct cluster_t {
     struct obj_t *obj; // an array of the cluster objects
 } cluster_t;
 
+// file that is read in the large blocks, lines are taken from the block (same as fgets would return them)
+typedef struct reader_t {
+    FILE *f;
+    size_t pos;  // position of the next character in the block
+    size_t len;  // number of the characters in the block
+    char block[READ_BLOCK_SIZE];
+} reader_t;
+
+// output that is collected in a large block and written at once when the block is full
+typedef struct writer_t {
+    FILE *f;
+    size_t len;  // number of the characters in the block
+    bool error;  // some block couldn't be written
+    char block[WRITE_BLOCK_SIZE];
+} writer_t;
+
 // structure that contains program arguments
 typedef struct arguments_t {
     char *filename;  // file which contains objects
     char flag;  // specifies which clustering algorithm will be used
     int required_clusters;  // final number of clusters
+    unsigned long long seed;  // seed of the random number generator (k-means)
+    int threads;  // number of the threads
+    unsigned long long memory;  // memory budget in MiB of the large-input mode, 0 if the mode is off
+    char *output;  // binary file made by the 'convert' subcommand, NULL if the objects are clustered
+    char *linkage;  // file for the linkage matrix, NULL if it isn't written
+    int cuts[MAX_CUTS];  // numbers of the clusters printed from one clustering
+    int cut_count;  // number of the cuts, 0 if only the required number of the clusters is printed
+    char *state;  // state file of the clustering (written by '--save-state', updated by 'insert'), NULL if not used
+    bool insert;  // new objects from the file are added to the clustering in the state file
+    int minibatch;  // number of the objects in one batch of mini-batch k-means, 0 if the whole object array is used
+    int max_iter;  // maximum number of the iterations of k-means, 0 for the default
+    double tol;  // k-means stops when no centroid moved more than this distance
+    char format;  // format of the printed clusters: 't' - text, 'c' - csv, 'j' - json, 'b' - binary labels
+    bool stats;  // statistics of the run are printed to stderr
+    char *stats_file;  // file the statistics are written to as JSON, NULL if they are only printed
 } arguments_t;
 
+// header of the binary input file, it is followed by the columns of the ids, x-coordinates and y-coordinates
+// numbers are stored in the byte order of the machine that made the file
+typedef struct binary_header_t {
+    char magic[4];  // BINARY_MAGIC
+    uint32_t version;  // BINARY_VERSION
+    uint64_t count;  // number of the objects
+    uint32_t id_width;  // number of the bytes of one id (4 or 8)
+    uint32_t coordinate_type;  // BINARY_FLOAT32
+} binary_header_t;
+
+// header of the binary output file of the labels ('--format labels-bin'), it is followed by 'count' records
+// of the objects: 32-bit id and 32-bit cluster, numbers are stored in the byte order of the machine
+typedef struct labels_header_t {
+    char magic[4];  // LABELS_MAGIC
+    uint32_t version;  // LABELS_VERSION
+    uint64_t count;  // number of the objects
+    uint32_t clusters;  // number of the clusters
+    uint32_t id_width;  // number of the bytes of one id (always 4)
+} labels_header_t;
+
+// set of the object ids that were already read
+// bitmap of the ids up to MAX_CLUSTER_NUMBER, hash table with open addressing in the large-input mode (ids up to INT_MAX)
+typedef struct id_set_t {
+    unsigned char *bits;  // bitmap of the ids, NULL in the large-input mode
+    long long *keys;  // slots of the hash table, 0 is an empty slot (ids are positive)
+    size_t mask;  // number of the slots - 1 (number of the slots is a power of two)
+} id_set_t;
+
+// state of the random number generator (splitmix64)
+// every run with the same seed generates the same numbers
+typedef struct random_t {
+    uint64_t state;
+} random_t;
+
 // a pointer to the function that calculates a distance between two objects depending on the clustering algorithm
 // it has two parameters (cluster_t * and cluster_t *) and returns a float value
 typedef float (*distanceFunction)(cluster_t *, cluster_t *);
 
+// a pointer to the function that is run by every thread of the pool
+// it has three parameters: context of the task, index of the thread and number of the threads
+typedef void (*taskFunction)(void *, int, int);
+
+// pool of the threads that run the same task on different parts of the data
+// the thread that runs the task is the thread with index 0, other threads wait for the tasks
+typedef struct pool_t {
+    int threads;  // number of the threads including the main thread
+    int started;  // number of the worker threads that were started
+    pthread_t *workers;  // worker threads
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // new task was added or the pool is stopping
+    pthread_cond_t done;  // all worker threads finished the task
+    taskFunction task;  // current task
+    void *context;  // context of the current task
+    unsigned long generation;  // number of the tasks that were added
+    unsigned long long *distances;  // distances of every worker thread in the current task ('--stats', 0 is unused)
+    int running;  // number of the worker threads that run the current task
+    bool stop;  // worker threads have to finish
+} pool_t;
+
+// temporary arrays of the algorithms that the library context keeps between the runs (the blocks only grow)
+// the blocks are given out like a stack, a returned block at the top is given out again by the next allocation
+typedef struct scratch_t {
+    void *block[SCRATCH_BLOCKS];
+    size_t size[SCRATCH_BLOCKS];  // number of the bytes of the block
+    bool busy[SCRATCH_BLOCKS];  // block is given out
+    int used;  // number of the blocks up to the last block that is given out
+} scratch_t;
+
+// context of the library (declared in cluster.h)
+// the program uses it the same way, only the objects are read from the file directly to its arrays
+struct cluster_context_t {
+    pool_t pool;  // threads used by the clustering algorithms
+    scratch_t scratch;  // temporary arrays of the runs (library only)
+    obj_t *objects;  // objects that are clustered
+    int size;  // number of the objects
+    int capacity;  // number of the objects the arrays of the objects and the labels were allocated for
+    cluster_t *clusters;  // clusters, the final clusters are at the beginning
+    int cluster_capacity;  // number of the initialized clusters in the array
+    int *labels;  // cluster of every object (library only)
+};
+
+// context of the parallel search for the two nearest clusters (find_neighbours)
+typedef struct neighbours_task_t {
+    cluster_t *carr;  // an array of clusters
+    int *active;  // indexes of the active clusters in their order
+    int count;  // number of the active clusters
+    distanceFunction get_distance;
+    float min[MAX_THREADS];  // distance between the nearest clusters found by every thread
+    int c1[MAX_THREADS];  // indexes of the nearest clusters found by every thread
+    int c2[MAX_THREADS];
+} neighbours_task_t;
+
+// objects stored as the separate arrays of the coordinates (structure of arrays),
+// so the distances from one point to many points can be computed with the vector instructions
+typedef struct points_t {
+    int size;  // number of the points
+    float *x;  // x-coordinates of the points
+    float *y;  // y-coordinates of the points
+} points_t;
+
+// cached distances between all pairs of the clusters (used by complete/average linkage)
+// only the lower triangle of the symmetric matrix is stored
+typedef struct distance_matrix_t {
+    int size;  // number of the rows (clusters the matrix was built for)
+    float *dist;  // distance between clusters i < j is stored at index j * (j - 1) / 2 + i
+} distance_matrix_t;
+
+// objects of the clusters of average linkage, every row of the distance matrix has a list of its objects sorted
+// by the ids (the merged clusters of find_neighbours are sorted the same way, see merge_clusters)
+typedef struct members_t {
+    int *head;  // first object of the row, -1 if the row was merged
+    int *next;  // next object of the same row, -1 after the last object
+    obj_t *first;  // objects of the first cluster of exactDistance
+    obj_t *second;  // objects of the second cluster of exactDistance
+    float *cached;  // cached distance of the merge that merged the row to another row
+} members_t;
+
+// uniform grid over an array of the objects
+// objects are sorted into the square cells, so only the cells around a point have to be searched
+typedef struct grid_t {
+    obj_t *objects;  // indexed objects
+    int size;  // number of the indexed objects
+    int cols;  // number of the cells in one row/column
+    float cell_size;  // width/height of one cell
+    int *cell_start;  // objects of the cell c are items[cell_start[c]] .. items[cell_start[c + 1] - 1]
+    int *items;  // indexes of the objects sorted by the cells
+} grid_t;
+
+// state of k-means clustering
+// clusters are represented by the labels of the objects and the sums of the coordinates of their objects
+// bounds of the distances between the objects and the centroids are used to skip the objects whose nearest centroid
+// can't change (Hamerly's algorithm): upper bound of an object is smaller than its lower bound
+typedef struct kmeans_t {
+    int *label;  // index of the nearest centroid (cluster) of every object, -1 if object wasn't assigned yet
+    double *upper;  // upper bound of the distance to the nearest centroid of every object
+    double *lower;  // lower bound of the distance to the other centroids of every object
+    double *half_gap;  // half of the distance from every centroid to the nearest other centroid
+    double *drift;  // distance every centroid moved in the last update
+    obj_t *previous;  // centroids before the last update
+    long long *sum_x;  // sum of the x-coordinates of the objects of every cluster
+    long long *sum_y;  // sum of the y-coordinates of the objects of every cluster
+    int *count;  // number of the objects of every cluster
+    int *weight;  // number of the objects every object stands for (collapsed duplicates), NULL if only for itself
+    double max_drift;  // the longest move of a centroid in the last update
+    int threads;  // number of the threads that assign the objects
+    long long *part_x;  // changes of the sums made by every thread in the last assignment (threads * clusters)
+    long long *part_y;
+    int *part_count;
+} kmeans_t;
+
+// context of the parallel assignment of the objects to the clusters (k-means)
+// every thread assigns one contiguous part of the objects and adds the changes of the sums to its own partial sums
+typedef struct assign_task_t {
+    obj_t *object_arr;
+    int object_arr_size;
+    obj_t *centroid_arr;
+    int required_clusters;
+    grid_t *grid;  // grid over the centroids (first assignment), NULL otherwise
+    kmeans_t *km;
+    bool first;  // first assignment, objects have no bounds yet
+    bool failed[MAX_THREADS];  // thread found an object without the nearest centroid
+    unsigned long long moved[MAX_THREADS];  // number of the objects every thread moved to another cluster
+} assign_task_t;
+
+// context of the parallel computation of the distance matrix
+typedef struct matrix_task_t {
+    distance_matrix_t *m;
+    cluster_t *cluster_arr;
+    distanceFunction get_distance;
+    points_t *points;  // points of the clusters if all clusters have one object, NULL otherwise
+    char flag;  // clustering method
+} matrix_task_t;
+
+// context of the parallel update of the distances to the tree in Prim's algorithm
+typedef struct tree_task_t {
+    points_t *points;  // objects of the tree
+    int size;  // number of the objects
+    int last;  // object that was added to the tree
+    float *tree_dist;  // squared distance of every object to the tree, negative if object is in the tree
+    int *nearest;  // nearest object in the tree of every object
+    int closest[MAX_THREADS];  // closest object to the tree found by every thread
+} tree_task_t;
+
+// structure that contains an edge of the minimum spanning tree or a merge of two clusters
+typedef struct edge_t {
+    int a;  // index of the first object/cluster
+    int b;  // index of the second object/cluster
+    float distance;  // distance between the objects/clusters
+} edge_t;
+
+// sufficient statistics of a cluster of Ward/centroid linkage, the distance of two clusters is computed only from them
+typedef struct moments_t {
+    int count;  // number of the objects, 0 if the cluster was merged to another one
+    long long sum_x;  // sum of the x-coordinates of the objects
+    long long sum_y;  // sum of the y-coordinates of the objects
+    double x;  // centroid of the cluster (sum / count), kept so the distance needs no division
+    double y;
+} moments_t;
+
+// context of the parallel search for the nearest cluster of every cluster (Ward/centroid linkage)
+typedef struct nearest_task_t {
+    moments_t *moments;
+    int *active;  // indexes of the clusters in their order, merged clusters are removed from time to time
+    int size;  // number of the indexes in 'active'
+    char flag;  // 'w' or 'm'
+    int *nearest;  // nearest cluster with a greater index of every cluster, -1 if there is none
+    double *nearest_dist;  // squared distance to the nearest cluster
+    int a;  // cluster 'b' was merged to the cluster 'a' in the last step, -1 before the first merge
+    int b;
+    int best[MAX_THREADS];  // cluster with the nearest other cluster found by every thread, -1 if none was found
+} nearest_task_t;
+
+// merges of the hierarchical clustering, any number of the clusters can be made from them
+typedef struct hierarchy_t {
+    obj_t *objects;  // objects (the object array of the context), the merges contain their indexes
+    int size;  // number of the objects
+    edge_t *merges;  // merges ordered from the first one
+    int merge_count;  // number of the merges
+    bool tree;  // merges are the edges of the minimum spanning tree (single linkage)
+    bool average;  // distances of average linkage are (sum - 1) / (ni * nj), see cluster_distance_average
+} hierarchy_t;
+
+// objects with the same coordinates collapsed to one object that stands for all of them
+typedef struct duplicates_t {
+    obj_t *objects;  // first object of every group of the objects with the same coordinates
+    int *weight;  // number of the objects of every group
+    int *first;  // index of the first object of every group in the object array
+    int *group;  // group of every object of the object array
+    int size;  // number of the groups, they are in the order of their first objects
+} duplicates_t;
+
+// header of the state file ('--save-state'), numbers are stored in the byte order of the machine
+// k-means:         header, 'clusters' records state_cluster_t and the hash table of the ids
+// single linkage:  header, table of the positions (STATE_SIDE x STATE_SIDE labels of the clusters, -1 if there is
+//                  no object at the position), hash table of the ids, parents of the labels and the other labels
+//                  of the positions (records state_extra_t)
+// an insert reads only the slots, positions and labels it needs and appends the sections that have to grow
+typedef struct state_header_t {
+    char magic[4];  // STATE_MAGIC
+    uint32_t version;  // STATE_VERSION
+    uint32_t flag;  // 'k' or 's'
+    uint32_t clusters;  // number of the clusters (single linkage: number of the labels, merged labels are unused)
+    uint64_t objects;  // number of the saved objects
+    uint64_t id_offset;  // offset of the hash table of the ids (32-bit slots, 0 is an empty slot)
+    uint64_t id_slots;  // number of the slots (power of two, the table is at most half full)
+    uint64_t parent_offset;  // single linkage: offset of the parents of the labels (32-bit, root is its own parent)
+    uint64_t parent_capacity;  // single linkage: number of the labels the parents have space for
+    uint64_t extra_offset;  // single linkage: offset of the other labels of the positions with more clusters
+    uint64_t extra_count;  // single linkage: number of the other labels (there are some only if the distance is 0)
+    float distance;  // single linkage: objects at most this far are in the same cluster (negative if none are)
+    uint32_t reserved;  // always 0
+} state_header_t;
+
+// sums of the coordinates and the size of one k-means cluster in the state file
+typedef struct state_cluster_t {
+    int64_t sum_x;
+    int64_t sum_y;
+    int64_t count;
+} state_cluster_t;
+
+// other label of a position that has objects of more clusters, the records are sorted by the positions
+typedef struct state_extra_t {
+    int32_t position;  // y * STATE_SIDE + x
+    int32_t label;
+} state_extra_t;
+
+// writes of one insert to the state file, they are saved to the file 'STATE.journal' before they are made,
+// so an interrupted insert is finished when the state is opened again
+typedef struct journal_t {
+    unsigned char *data;  // records: 64-bit offset, 64-bit length and 'length' bytes
+    size_t size;  // number of the used bytes
+    size_t capacity;  // number of the allocated bytes
+} journal_t;
+
+// saved clustering that new objects can be added to (opened state file)
+// k-means keeps the sums of the coordinates and the sizes of the clusters in the memory, the rest stays in the file
+typedef struct state_t {
+    FILE *file;  // state file opened for reading and writing
+    char *filename;  // name of the state file
+    state_header_t header;
+    uint64_t end;  // end of the state file, sections that grow are moved there
+    long long *sum_x;  // k-means: sum of the x-coordinates of the cluster
+    long long *sum_y;  // k-means: sum of the y-coordinates of the cluster
+    int *count;  // k-means: number of the objects in the cluster
+    obj_t *centroids;  // k-means: centroid of the cluster (NaN if the cluster is empty)
+    journal_t journal;  // writes of the insert
+} state_t;
+
+// parents of the old labels that an insert to the single linkage state read (hash table with open addressing)
+typedef struct parent_map_t {
+    int *label;  // label of the slot, -1 if the slot is empty
+    int *parent;  // parent of the label
+    int *saved;  // parent of the label in the state file
+    size_t mask;  // number of the slots - 1 (number of the slots is a power of two)
+    int count;  // number of the used slots
+} parent_map_t;
+
+// phases of the run measured by '--stats'
+typedef enum phase_t {
+    PHASE_LOAD,  // reading of the file
+    PHASE_MERGES,  // merges of the hierarchical clustering (searches of the nearest clusters)
+    PHASE_CLUSTERS,  // making of the clusters from the merges (grouping and sorting of the objects)
+    PHASE_KMEANS,  // k-means iterations
+    PHASE_INSERT,  // insertion of the objects to the saved clustering
+    PHASE_OUTPUT  // printing of the clusters, writing of the files
+} phase_t;
+
+// statistics of the run ('--stats'), nothing is counted or measured if they are not enabled
+typedef struct stats_t {
+    bool enabled;
+    double wall[PHASE_COUNT];  // wall-clock time of every phase in seconds
+    double cpu[PHASE_COUNT];  // processor time of all threads in every phase in seconds
+    bool measured[PHASE_COUNT];  // phase ran at least once
+    double wall_start;  // start of the current phase
+    clock_t cpu_start;
+    unsigned long long distances;  // distances computed by all threads (the workers' counts are added after every task)
+    unsigned long long merges;  // merges of two clusters
+    unsigned long long iterations;  // k-means iterations (assignments of all objects to the centroids and batches)
+    unsigned long long reassignments;  // objects that k-means moved to another cluster
+    unsigned long long allocations;  // calls of malloc, calloc and realloc
+} stats_t;
+
+static stats_t stats;  // statistics are global, the distances are counted even in the functions that get only objects
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t distance_key;  // counter of the distances of the worker thread, NULL in the main thread
+static pthread_key_t scratch_key;  // scratch memory of the library run of this thread, NULL outside clusterRun
+
+void createKeys(void)
+{
+    pthread_key_create(&distance_key, NULL);
+    pthread_key_create(&scratch_key, NULL);
+}
+
+// a worker thread counts the distances in its own counter of the pool, the main thread directly in the statistics
+void addDistances(unsigned long long count)
+{
+    pthread_once(&key_once, createKeys);
+    unsigned long long *counter = (unsigned long long *) pthread_getspecific(distance_key);
+
+    if(counter != NULL)
+        *counter += count;
+    else
+        stats.distances += count;
+}
+
+// counts 'count' computed distances between two objects (it is called once for a whole loop, not for every distance)
+void countDistances(unsigned long long count)
+{
+    if(stats.enabled)
+        addDistances(count);
+}
+
+// every allocation of the program is counted by these functions
+void *countAllocation(void *ptr)
+{
+    if(stats.enabled)
+        stats.allocations++;
+
+    return ptr;
+}
+
+void *countedMalloc(size_t size)
+{
+    return countAllocation(malloc(size));
+}
+
+void *countedCalloc(size_t count, size_t size)
+{
+    return countAllocation(calloc(count, size));
+}
+
+void *countedRealloc(void *ptr, size_t size)
+{
+    return countAllocation(realloc(ptr, size));
+}
+
+// temporary arrays of the algorithms are allocated by scratchMalloc/scratchCalloc and freed by scratchFree
+// inside clusterRun they are the blocks of the scratch memory of the context, so the next runs don't allocate them again,
+// otherwise (and when all blocks are given out) they are allocated by malloc
+void *scratchMalloc(size_t size)
+{
+    pthread_once(&key_once, createKeys);
+    scratch_t *s = (scratch_t *) pthread_getspecific(scratch_key);
+
+    if(s == NULL || s->used == SCRATCH_BLOCKS)
+        return countedMalloc(size);
+
+    int i = s->used;
+
+    if(s->block[i] == NULL || s->size[i] < size)
+    {
+        free(s->block[i]);
+        s->block[i] = countedMalloc(size);
+        s->size[i] = s->block[i] != NULL ? size : 0;
+
+        if(s->block[i] == NULL)
+            return NULL;
+    }
+
+    s->busy[i] = true;
+    s->used++;
+    return s->block[i];
+}
+
+void *scratchCalloc(size_t count, size_t size)
+{
+    void *ptr = scratchMalloc(count * size);
+
+    if(ptr != NULL)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+void scratchFree(void *ptr)
+{
+    pthread_once(&key_once, createKeys);
+    scratch_t *s = (scratch_t *) pthread_getspecific(scratch_key);
+
+    for(int i = 0; s != NULL && i < s->used; i++)
+    {
+        if(s->busy[i] && s->block[i] == ptr)
+        {
+            s->busy[i] = false;
+
+            // the blocks at the top can be given out again
+            while(s->used > 0 && !s->busy[s->used - 1])
+                s->used--;
+
+            return;
+        }
+    }
+
+    free(ptr);
+}
+
+// frees the blocks of the scratch memory
+void destroyScratch(scratch_t *s)
+{
+    for(int i = 0; i < SCRATCH_BLOCKS; i++)
+        free(s->block[i]);
+
+    *s = (scratch_t) {0};
+}
+
+double wallTime(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// phases don't overlap, every phase is measured from startPhase to endPhase
+void startPhase(void)
+{
+    if(!stats.enabled)
+        return;
+
+    stats.wall_start = wallTime();
+    stats.cpu_start = clock();
+}
+
+void endPhase(phase_t phase)
+{
+    if(!stats.enabled)
+        return;
+
+    stats.wall[phase] += wallTime() - stats.wall_start;
+    stats.cpu[phase] += (double) (clock() - stats.cpu_start) / CLOCKS_PER_SEC;
+    stats.measured[phase] = true;
+}
+
 /*****************************************************************
  * Deklarace potrebnych funkci.
  *
@@ -114,7 +656,7 @@ void *init_cluster(cluster_t *c, int cap)
 
     if(cap > 0)
     {
-        c->obj = (obj_t *) malloc(sizeof(obj_t) * cap);
+        c->obj = (obj_t *) countedMalloc(sizeof(obj_t) * cap);
 
         if(c->obj == NULL)
             return NULL;
@@ -157,7 +699,7 @@ cluster_t *resize_cluster(cluster_t *c, int new_cap)
 
     size_t size = sizeof(obj_t) * new_cap;
 
-    void *arr = realloc(c->obj, size);
+    void *arr = countedRealloc(c->obj, size);
     if (arr == NULL)
         return NULL;
 
@@ -166,6 +708,19 @@ cluster_t *resize_cluster(cluster_t *c, int new_cap)
     return c;
 }
 
+// makes sure that the cluster has a place for 'needed' objects
+// the capacity grows at least twice (at least by CLUSTER_CHUNK), so n appended objects need only O(log n) reallocations
+cluster_t *growCluster(cluster_t *c, int needed)
+{
+    if(c->capacity >= needed)
+        return c;
+
+    int grown = c->capacity > CLUSTER_CHUNK ? c->capacity : CLUSTER_CHUNK;
+    grown = c->capacity <= INT_MAX - grown ? c->capacity + grown : INT_MAX;
+
+    return resize_cluster(c, grown > needed ? grown : needed);
+}
+
 /*
  Prida objekt 'obj' na konec shluku 'c'. Rozsiri shluk, pokud se do nej objekt
  nevejde.
@@ -175,7 +730,7 @@ void *append_cluster(cluster_t *c, obj_t obj)
 {
     if(c->capacity == c->size)
     {
-        if(resize_cluster(c, c->capacity + CLUSTER_CHUNK) == NULL)
+        if(growCluster(c, c->size + 1) == NULL)
             return NULL;
     }
 
@@ -194,15 +749,45 @@ void sort_cluster(cluster_t *c);
  Shluk 'c2' bude nezmenen.
  */
 
+// checks if the objects of the cluster are sorted by their ids
+bool isClusterSorted(cluster_t *c)
+{
+    for(int i = 1; i < c->size; i++)
+        if(c->obj[i - 1].id > c->obj[i].id)
+            return false;
+
+    return true;
+}
+
 void *merge_clusters(cluster_t *c1, cluster_t *c2)
 {
     assert(c1 != NULL);
     assert(c2 != NULL);
 
-    for(int j = 0; j < c2->size; j++)
-        append_cluster(c1, c2->obj[j]);
+    if(growCluster(c1, c1->size + c2->size) == NULL)
+        return NULL;
+
+    if(!isClusterSorted(c1) || !isClusterSorted(c2))
+    {
+        for(int j = 0; j < c2->size; j++)
+            append_cluster(c1, c2->obj[j]);
+
+        sort_cluster(c1);
+        return c1;
+    }
+
+    // both clusters are sorted, so they are merged from the end without sorting again
+    int i = c1->size - 1, j = c2->size - 1;
 
-    sort_cluster(c1);
+    for(int k = c1->size + c2->size - 1; j >= 0; k--)
+    {
+        if(i >= 0 && c1->obj[i].id > c2->obj[j].id)
+            c1->obj[k] = c1->obj[i--];
+        else
+            c1->obj[k] = c2->obj[j--];
+    }
+
+    c1->size += c2->size;
     return c1;
 }
 
@@ -241,6 +826,13 @@ float obj_distance(obj_t *o1, obj_t *o2)
     return sqrt((o1->x - o2->x) * (o1->x - o2->x) + (o1->y - o2->y) * (o1->y - o2->y));
 }
 
+// squared Euclidean distance of two objects, used where the distances are only compared
+// coordinates are integers, so the squares are exact and their order is the same as the order of the distances
+float squaredDistance(obj_t *o1, obj_t *o2)
+{
+    return (o1->x - o2->x) * (o1->x - o2->x) + (o1->y - o2->y) * (o1->y - o2->y);
+}
+
 /*
  Pocita vzdalenost dvou shluku.
 */
@@ -253,20 +845,22 @@ float cluster_distance_single(cluster_t *c1, cluster_t *c2)
     assert(c2 != NULL);
     assert(c2->size > 0);
 
-    float min = MAX_CLUSTER_DISTANCE;
+    countDistances((unsigned long long) c1->size * c2->size);
+
+    float min = INFINITY;  // squared distance
 
     for(int i = 0; i < c1->size; i++)
     {
         for(int j = 0; j < c2->size; j++)
         {
-            float distance = obj_distance(&c1->obj[i], &c2->obj[j]);
+            float distance = squaredDistance(&c1->obj[i], &c2->obj[j]);
 
             if(distance < min)
                 min = distance;
         }
     }
 
-    return min;
+    return sqrt(min);
 }
 
 // complete linkage
@@ -278,20 +872,22 @@ float cluster_distance_complete(cluster_t *c1, cluster_t *c2)
     assert(c2 != NULL);
     assert(c2->size > 0);
 
-    float max = MIN_CLUSTER_DISTANCE;
+    countDistances((unsigned long long) c1->size * c2->size);
+
+    float max = 0.0;  // squared distance
 
     for(int i = 0; i < c1->size; i++)
     {
         for(int j = 0; j < c2->size; j++)
         {
-            float distance = obj_distance(&c1->obj[i], &c2->obj[j]);
+            float distance = squaredDistance(&c1->obj[i], &c2->obj[j]);
 
             if(distance > max)
                 max = distance;
         }
     }
 
-    return max;
+    return sqrt(max);
 }
 
 // average linkage
@@ -303,6 +899,8 @@ float cluster_distance_average(cluster_t *c1, cluster_t *c2)
     assert(c2 != NULL);
     assert(c2->size > 0);
 
+    countDistances((unsigned long long) c1->size * c2->size);
+
     float avg = MIN_CLUSTER_DISTANCE;
 
     for(int i = 0; i < c1->size; i++)
@@ -374,21 +972,23 @@ void print_cluster(cluster_t *c)
     putchar('\n');
 }
 
-// checks if string contain an integer from the interval [1, 10000] inclusively
-bool checkNumber(char *str, int *number)
+// checks if string contain an integer from the interval [1, max] inclusively
+// (max is 10000 unless the program runs in the large-input mode)
+bool checkNumber(char *str, long long *number, long long max)
 {
     char *end_ptr;
-    long result = strtol(str, &end_ptr, 10);
+    errno = 0;
+    long long result = strtoll(str, &end_ptr, 10);
 
-    if(*end_ptr != '\0' || result < 1 || result > MAX_CLUSTER_NUMBER)
+    if(*end_ptr != '\0' || errno == ERANGE || result < 1 || result > max)
         return false;
 
-    *number = (int) result;
+    *number = result;
     return true;
 }
 
 // checks if the line contains a '\n' character
-// i.e. it contains at most 15 characters ("10000 1000 1000")
+// i.e. it contains at most 15 characters ("10000 1000 1000"), 20 in the large-input mode ("2147483647 1000 1000")
 bool checkLineLength(char *line)
 {
     if(strchr(line, '\n') == NULL)
@@ -399,7 +999,7 @@ bool checkLineLength(char *line)
 }
 
 // checks first line in the file
-bool checkFirstLine(char *line, int *object_number)
+bool checkFirstLine(char *line, int *object_number, arguments_t *a)
 {
     if(!checkLineLength(line))
     {
@@ -414,12 +1014,23 @@ bool checkFirstLine(char *line, int *object_number)
     }
 
     char *number = line + 6;
+    long long count;
 
-    if(checkNumber(number, object_number))
-        return true;
+    if(!checkNumber(number, &count, a->memory > 0 ? LLONG_MAX : MAX_CLUSTER_NUMBER))
+    {
+        fprintf(stderr, "Error! Number of the objects in the file must be a positive integer\n");
+        return false;
+    }
 
-    fprintf(stderr, "Error! Number of the objects in the file must be a positive integer\n");
-    return false;
+    // objects are indexed by int
+    if(count > INT_MAX)
+    {
+        fprintf(stderr, "Error! Number of the objects in the file must be at most %d\n", INT_MAX);
+        return false;
+    }
+
+    *object_number = (int) count;
+    return true;
 }
 
 // checks if there are two delimiters (spaces) following each other
@@ -452,27 +1063,102 @@ bool checkDelimiterNumber(char *line)
     return true;
 }
 
-// checks if the id is unique in the cluster/object array
-bool isIdUnique(cluster_t *cluster_arr, obj_t *object_arr, int size, int id, char flag)
+// allocates a memory for the set of the ids of 'size' objects
+bool initIdSet(id_set_t *set, int size, bool large)
 {
-    if(flag != 'k')
+    *set = (id_set_t) {0};
+
+    if(!large)
     {
-        for(int i = 0; i < size - 1; i++)  // we know that each cluster has exactly one object
-            if(cluster_arr[i].obj->id == id)
-                return false;
+        set->bits = (unsigned char *) countedCalloc(MAX_CLUSTER_NUMBER / 8 + 1, 1);
+        return set->bits != NULL;
+    }
+
+    // the table is at most half full
+    size_t slots = 2;
+
+    while(slots < (size_t) size * 2)
+        slots *= 2;
+
+    set->keys = (long long *) countedCalloc(slots, sizeof(long long));
+    set->mask = slots - 1;
+    return set->keys != NULL;
+}
+
+// frees a memory that was allocated for the set of the ids
+void destroyIdSet(id_set_t *set)
+{
+    free(set->bits);
+    free(set->keys);
+    *set = (id_set_t) {0};
+}
+
+// returns the first slot of the id in the hash table with 'mask' + 1 slots
+// multiplicative hashing, the upper bits are mixed into the lower bits that select the slot
+size_t idSlot(long long id, size_t mask)
+{
+    uint64_t hash = (uint64_t) id * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (hash ^ (hash >> 32)) & mask;
+}
+
+// checks if the id is unique, i.e. it isn't in the set of the ids yet, and adds it to the set
+bool isIdUnique(id_set_t *set, long long id)
+{
+    if(set->bits != NULL)
+    {
+        unsigned char bit = (unsigned char) (1 << (id % 8));
+
+        if(set->bits[id / 8] & bit)
+            return false;
 
+        set->bits[id / 8] |= bit;
         return true;
     }
 
-    // else
+    size_t slot = idSlot(id, set->mask);
 
-    for(int i = 0; i < size - 1; i++)
-        if(object_arr[i].id == id)
+    while(set->keys[slot] != 0)
+    {
+        if(set->keys[slot] == id)
             return false;
 
+        slot = (slot + 1) & set->mask;
+    }
+
+    set->keys[slot] = id;
     return true;
 }
 
+// parses the line in the common format "id x y\n" where all numbers consist only of digits in one pass
+// returns false if the line has some other format, then it has to be checked by the slower functions
+bool parsePlainLine(char *line, long long numbers[3])
+{
+    int field = 0;
+    bool digit = false;  // field has at least one digit
+    numbers[0] = 0;
+
+    for(char *c = line; ; c++)
+    {
+        if(*c >= '0' && *c <= '9')
+        {
+            // a number that doesn't fit into long long is marked as -1 (invalid)
+            if(numbers[field] > (LLONG_MAX - 9) / 10)
+                numbers[field] = -1;
+            else if(numbers[field] >= 0)
+                numbers[field] = numbers[field] * 10 + (*c - '0');
+
+            digit = true;
+        }
+        else if(*c == DELIMITER_CHAR && digit && field < 2)
+        {
+            numbers[++field] = 0;
+            digit = false;
+        }
+        else
+            return *c == '\n' && c[1] == '\0' && digit && field == 2;
+    }
+}
+
 // checks if string contains a float value with a zero decimal which is from the interval [0, 1000] inclusively
 bool checkCoordinate(char *str, float *num)
 {
@@ -484,9 +1170,22 @@ bool checkCoordinate(char *str, float *num)
     return fractional_part == 0.0 && *end_ptr == '\0' && *num >= 0.0 && *num <= 1000.0;
 }
 
-// checks line declaring an object in the file
-bool checkObjectLine(char *line, cluster_t *cluster_arr, obj_t *object_arr, int line_cnt, char flag)
+// checks line declaring an object in the file and saves the object to the array of the objects
+// ids can be at most 'max_id'
+bool checkObjectLine(char *line, obj_t *object_arr, id_set_t *ids, int line_cnt, long long max_id)
 {
+    obj_t *obj = &(object_arr[line_cnt - 1]);
+
+    long long numbers[3];
+
+    // valid line in the common format, any other line is checked again below to find the error
+    if(parsePlainLine(line, numbers) && numbers[0] >= 1 && numbers[0] <= max_id && numbers[1] >= 0 && numbers[1] <= 1000
+       && numbers[2] >= 0 && numbers[2] <= 1000 && isIdUnique(ids, numbers[0]))
+    {
+        *obj = (obj_t) {.id = (int) numbers[0], .x = (float) numbers[1], .y = (float) numbers[2]};
+        return true;
+    }
+
     if(!checkLineLength(line))
     {
         fprintf(stderr, "Error! Invalid line length in the line no. %d declaring an object'\n", line_cnt + 1);
@@ -499,24 +1198,19 @@ bool checkObjectLine(char *line, cluster_t *cluster_arr, obj_t *object_arr, int
         return false;
     }
 
-    obj_t *obj;
-
-    // if program performs k-means clustering the object from the file will be copied to the array of the objects
-    // otherwise it will be copied to the array of clusters (and it will be the only cluster object for a while)
-    if(flag != 'k')
-        obj = cluster_arr[line_cnt - 1].obj;
-    else
-        obj = &(object_arr[line_cnt - 1]);
-
     char *token = strtok(line, DELIMITER_STRING); // object id (string)
 
-    if(!checkNumber(token, &(obj->id)))
+    long long id;
+
+    if(token == NULL || !checkNumber(token, &id, max_id))
     {
         fprintf(stderr, "Error! Invalid object id on the line no. %d", line_cnt + 1);
         return false;
     }
 
-    if(!isIdUnique(cluster_arr, object_arr, line_cnt, obj->id, flag))
+    obj->id = (int) id;
+
+    if(!isIdUnique(ids, obj->id))
     {
         fprintf(stderr, "Error! Every object id must be unique\n");
         return false;
@@ -524,7 +1218,7 @@ bool checkObjectLine(char *line, cluster_t *cluster_arr, obj_t *object_arr, int
 
     token = strtok(NULL, DELIMITER_STRING); // object x-coordinate (string)
 
-    if(!checkCoordinate(token, &(obj->x)))
+    if(token == NULL || !checkCoordinate(token, &(obj->x)))
     {
         fprintf(stderr, "Error! Invalid object x coordinate on the line no. %d", line_cnt + 1);
         return false;
@@ -532,13 +1226,8 @@ bool checkObjectLine(char *line, cluster_t *cluster_arr, obj_t *object_arr, int
 
     token = strtok(NULL, DELIMITER_STRING); // object y-coordinate (string)
 
-    if(checkCoordinate(token, &(obj->y)))
-    {
-        if(flag != 'k')
-            (cluster_arr[line_cnt - 1].size)++; // increment the number of the objects in the cluster
-
+    if(token != NULL && checkCoordinate(token, &(obj->y)))
         return true;
-    }
 
     fprintf(stderr, "Error! Invalid object y coordinate on the line no. %d", line_cnt + 1);
     return false;
@@ -563,484 +1252,4475 @@ void destroy(cluster_t *cluster_arr, int cluster_arr_size, obj_t *object_arr)
     }
 }
 
-/*
- Tisk pole shluku. Parametr 'carr' je ukazatel na prvni polozku (shluk).
- Tiskne se prvnich 'narr' shluku.
-*/
-void print_clusters(cluster_t *carr, int narr)
+// writes the block to the file and empties it
+void flushWriter(writer_t *w)
 {
-    printf("Clusters:\n");
-    for (int i = 0; i < narr; i++)
-    {
-        printf("cluster %d: ", i);
-        print_cluster(&carr[i]);
-    }
+    if(w->len > 0 && fwrite(w->block, 1, w->len, w->f) != w->len)
+        w->error = true;
+
+    w->len = 0;
 }
 
-bool initAllClusters(cluster_t *cluster_arr, int cluster_arr_size)
+// adds 'size' bytes to the block (size is at most WRITE_BLOCK_SIZE)
+void writeBytes(writer_t *w, const void *data, size_t size)
 {
-    // firstly initialize a cluster to {.size = 0, .cap = 0, .obj = NULL}
-    // in order to prevent freeing memory that wasn't allocated
-    for(int i = 0; i < cluster_arr_size; i++)
-        init_cluster(&cluster_arr[i], 0);
+    if(w->len + size > WRITE_BLOCK_SIZE)
+        flushWriter(w);
 
-    // then initialize every cluster with capacity 1
-    for(int i = 0; i < cluster_arr_size; i++)
-        if(init_cluster(&cluster_arr[i], 1) == NULL)
-            return false;
+    memcpy(w->block + w->len, data, size);
+    w->len += size;
+}
 
-    return true;
+void writeString(writer_t *w, const char *str)
+{
+    writeBytes(w, str, strlen(str));
 }
 
-bool init(cluster_t **cluster_arr, obj_t **object_arr, int arr_size, arguments_t *a)
+// writes the number in decimal, the digits are made from the end without printf
+void writeInteger(writer_t *w, long long number)
 {
-    if(a->flag != 'k')
+    char digits[21];  // "-9223372036854775808"
+    int i = sizeof(digits);
+    unsigned long long u = number < 0 ? 0ULL - (unsigned long long) number : (unsigned long long) number;
+
+    do
     {
-        // allocate memory for an array of the clusters and initialize all clusters
-        *cluster_arr = (cluster_t *) malloc(arr_size * sizeof(cluster_t));
-        return *cluster_arr != NULL && initAllClusters(*cluster_arr, arr_size);
-    }
+        digits[--i] = (char) ('0' + u % 10);
+        u /= 10;
+    } while(u > 0);
 
-    // if flag == 'k'
-    // allocate memory for an array of the objects and clusters and initialize all clusters
-    *object_arr = (obj_t *) malloc(arr_size * sizeof(obj_t));
-    *cluster_arr = (cluster_t *) malloc(a->required_clusters * sizeof(cluster_t));
+    if(number < 0)
+        digits[--i] = '-';
 
-    return *object_arr != NULL && *cluster_arr != NULL && initAllClusters(*cluster_arr, a->required_clusters);
+    writeBytes(w, digits + i, sizeof(digits) - i);
 }
 
-bool processFile(cluster_t **cluster_arr, obj_t **object_arr, int *arr_size, FILE *f, arguments_t *a)
+// writes the coordinate the same way as printf("%g") does, coordinates are integers from the interval [0, 1000]
+// (-0 is a valid coordinate too)
+void writeCoordinate(writer_t *w, float number)
+{
+    if(signbit(number))
+        writeBytes(w, "-", 1);
+
+    writeInteger(w, (long long) fabsf(number));
+}
+
+// writes the clusters in the format of print_clusters
+void writeClustersText(writer_t *w, cluster_t *carr, int narr)
 {
-    char line[MAX_LINE_BUFFER_LENGTH]; // string that contains a line from the file
+    writeString(w, "Clusters:\n");
 
-    if((fgets(line, MAX_LINE_BUFFER_LENGTH, f)) != NULL)  // read first line
+    for(int i = 0; i < narr; i++)
     {
-        if(!checkFirstLine(line, arr_size))
-            return false;
+        writeString(w, "cluster ");
+        writeInteger(w, i);
+        writeString(w, ": ");
 
-        if(!init(cluster_arr, object_arr, *arr_size, a))
+        for(int j = 0; j < carr[i].size; j++)
         {
-            if(a->flag != 'k')
-                fprintf(stderr, "Error! Couldn't allocate memory for an array of clusters/initialize a cluster\n");
-            else
-                fprintf(stderr, "Error! Couldn't allocate memory for an array of objects/clusters/initialize a cluster\n");
+            obj_t *obj = &carr[i].obj[j];
 
-            return false;
+            if(j > 0)
+                writeBytes(w, " ", 1);
+
+            writeInteger(w, obj->id);
+            writeBytes(w, "[", 1);
+            writeCoordinate(w, obj->x);
+            writeBytes(w, ",", 1);
+            writeCoordinate(w, obj->y);
+            writeBytes(w, "]", 1);
         }
+
+        writeBytes(w, "\n", 1);
+    }
+}
+
+// writes the cluster of every object (id -> cluster), the objects are in the order of the clusters
+// 'c' - csv with the header "id,cluster", 'j' - json object {"clusters": K, "labels": [{"id": ID, "cluster": C}, ...]},
+// 'b' - labels_header_t followed by the binary records
+void writeLabels(writer_t *w, cluster_t *carr, int narr, char format)
+{
+    if(format == 'c')
+        writeString(w, "id,cluster\n");
+    else if(format == 'j')
+    {
+        writeString(w, "{\"clusters\":");
+        writeInteger(w, narr);
+        writeString(w, ",\"labels\":[");
     }
     else
-    { // if fgets function returned NULL
-        fprintf(stderr, "Error! File '%s' is empty\n", a->filename);
-        return false;
+    {
+        labels_header_t header = {.magic = LABELS_MAGIC, .version = LABELS_VERSION, .clusters = narr, .id_width = 4};
+
+        for(int i = 0; i < narr; i++)
+            header.count += carr[i].size;
+
+        writeBytes(w, &header, sizeof(labels_header_t));
     }
 
-    int line_cnt = 1; // number of the lines in the file
+    bool first = true;
 
-    while((fgets(line, MAX_LINE_BUFFER_LENGTH, f)) != NULL)
+    for(int i = 0; i < narr; i++)
     {
-        // if the program already read specified number of the objects stop reading file
-        if(line_cnt == *arr_size + 1)  // line_cnt == number of objects + 1 (first line 'count=x')
-            break;
+        for(int j = 0; j < carr[i].size; j++)
+        {
+            int32_t id = carr[i].obj[j].id;
 
-        if(!checkObjectLine(line, *cluster_arr, *object_arr, line_cnt, a->flag))
-            return false;
+            if(format == 'c')
+            {
+                writeInteger(w, id);
+                writeBytes(w, ",", 1);
+                writeInteger(w, i);
+                writeBytes(w, "\n", 1);
+            }
+            else if(format == 'j')
+            {
+                writeString(w, first ? "\n{\"id\":" : ",\n{\"id\":");
+                writeInteger(w, id);
+                writeString(w, ",\"cluster\":");
+                writeInteger(w, i);
+                writeBytes(w, "}", 1);
+            }
+            else
+            {
+                uint32_t label = i;
+                writeBytes(w, &id, sizeof(id));
+                writeBytes(w, &label, sizeof(label));
+            }
 
-        line_cnt++;
+            first = false;
+        }
     }
 
-    // if there are fewer objects than first line specified
-    if(line_cnt != *arr_size + 1)
+    if(format == 'j')
+        writeString(w, "\n]}\n");
+}
+
+// prints the first 'narr' clusters to the standard output in the format of '--format'
+bool writeClusters(cluster_t *carr, int narr, char format)
+{
+    writer_t w = {.f = stdout};
+    startPhase();
+
+    if(format == 't')
+        writeClustersText(&w, carr, narr);
+    else
+        writeLabels(&w, carr, narr, format);
+
+    flushWriter(&w);
+
+    bool result = !w.error && fflush(stdout) == 0;
+    endPhase(PHASE_OUTPUT);
+
+    if(!result)
     {
-        fprintf(stderr, "Error! Expected %d objects in the file '%s', but got %d\n", *arr_size, a->filename, line_cnt - 1);
+        fprintf(stderr, "Error! Couldn't write the clusters to the standard output\n");
         return false;
     }
 
-    fclose(f);
     return true;
 }
 
 /*
- Ze souboru 'filename' nacte objekty. Pro kazdy objekt vytvori shluk a ulozi
- jej do pole shluku. Alokuje prostor pro pole vsech shluku a ukazatel na prvni
- polozku pole (ukalazatel na prvni shluk v alokovanem poli) ulozi do pameti,
- kam se odkazuje parametr 'arr'. Funkce vraci pocet nactenych objektu (shluku).
- V pripade nejake chyby uklada do pameti, kam se odkazuje 'arr', hodnotu NULL.
+ Tisk pole shluku. Parametr 'carr' je ukazatel na prvni polozku (shluk).
+ Tiskne se prvnich 'narr' shluku.
 */
+void print_clusters(cluster_t *carr, int narr)
+{
+    // the same output as print_cluster makes for every cluster, but written in the large blocks
+    writeClusters(carr, narr, 't');
+}
 
-int load_clusters(cluster_t **cluster_arr, obj_t **object_arr, arguments_t *a)
+// initializes all clusters to {.size = 0, .cap = 0, .obj = NULL}
+// the final clusters allocate their memory only once, when they are filled with their objects
+bool initAllClusters(cluster_t *cluster_arr, int cluster_arr_size)
 {
-    assert(cluster_arr != NULL);
+    for(int i = 0; i < cluster_arr_size; i++)
+        init_cluster(&cluster_arr[i], 0);
 
-    FILE *f = fopen(a->filename, "r");
+    return true;
+}
 
-    if(f == NULL)
-    {
-        fprintf(stderr, "Error! Couldn't open a file '%s'\n", a->filename);
-        return -1;
-    }
+// estimates the number of the bytes that are needed to read and cluster 'size' objects
+double requiredMemory(int size, arguments_t *a)
+{
+    double n = size, k = a->required_clusters;
 
-    // number of objects in the object array/number of clusters in cluster array (depends on clustering algorithm)
-    int arr_size = 0;
+    // the read objects and the objects in the final clusters, the set of the ids exists only while reading
+    double objects = 2 * n * sizeof(obj_t) + k * sizeof(cluster_t);
+    double ids = 4 * n * sizeof(long long);
 
-    if(!processFile(cluster_arr, object_arr, &arr_size, f, a))
-    {
-        // if some error occurred and the program was performing k-means algorithm, only 'required_clusters' clusters
-        // need to be freed
-        if(a->flag == 'k')
-            arr_size = a->required_clusters;
+    // labels of the objects, bounds of the distances, centroids and their sums (and the batch of mini-batch k-means)
+    if(a->flag == 'k')
+        return objects + fmax(ids, n * (sizeof(int) + 2 * sizeof(double)) + k * (3 * sizeof(obj_t) + 48) +
+                                   a->minibatch * 2.0 * sizeof(int));
 
-        destroy(*cluster_arr, arr_size, *object_arr);
-        fclose(f);
+    // merges, sums of the clusters and their nearest clusters
+    if(a->flag == 'w' || a->flag == 'm')
+        return objects + fmax(ids, n * (sizeof(edge_t) + sizeof(moments_t) + sizeof(int) + sizeof(double)));
+
+    // tree, its edges and coordinates, sets of the objects and the grid for the ties
+    if(a->flag == 's')
+        return objects + fmax(ids, n * (sizeof(edge_t) + sizeof(float) * 3 + sizeof(int) * 9 + sizeof(bool)));
+
+    // one cluster per object and the distance matrix
+    return objects + n * sizeof(cluster_t) + fmax(ids, n * (n - 1) / 2 * sizeof(float) + n * (2 * sizeof(int) + sizeof(edge_t)));
+}
+
+// objects are read to one array of the objects, clusters are made from it after the clustering
+bool init(cluster_t **cluster_arr, obj_t **object_arr, int arr_size, arguments_t *a)
+{
+    // allocate memory for an array of the objects and clusters and initialize all clusters
+    *object_arr = (obj_t *) countedMalloc(arr_size * sizeof(obj_t));
+    *cluster_arr = (cluster_t *) countedMalloc(a->required_clusters * sizeof(cluster_t));
+
+    return *object_arr != NULL && *cluster_arr != NULL && initAllClusters(*cluster_arr, a->required_clusters);
+}
+
+// checks the memory budget and allocates the arrays for 'arr_size' objects
+bool allocateObjects(cluster_t **cluster_arr, obj_t **object_arr, int arr_size, arguments_t *a)
+{
+    double memory = requiredMemory(arr_size, a) / MEBIBYTE;
+
+    if(a->memory > 0 && memory > a->memory)
+    {
+        fprintf(stderr, "Error! Clustering of %d objects needs about %.0f MiB of memory, but the memory budget is %llu MiB\n",
+                arr_size, ceil(memory), a->memory);
+        return false;
+    }
+
+    if(!init(cluster_arr, object_arr, arr_size, a))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for an array of objects/clusters/initialize a cluster\n");
+        return false;
+    }
+
+    return true;
+}
+
+// reads the next line from the file the same way as fgets does, but the file is read in the large blocks
+char *readLine(reader_t *r, char *line, int size)
+{
+    int i = 0;
+
+    while(i < size - 1)
+    {
+        if(r->pos == r->len)
+        {
+            r->len = fread(r->block, 1, READ_BLOCK_SIZE, r->f);
+            r->pos = 0;
+
+            if(r->len == 0)
+                break;
+        }
+
+        size_t n = r->len - r->pos;
+
+        if(n > (size_t) (size - 1 - i))
+            n = size - 1 - i;
+
+        char *end = memchr(r->block + r->pos, '\n', n);
+
+        if(end != NULL)
+            n = end - (r->block + r->pos) + 1;
+
+        memcpy(line + i, r->block + r->pos, n);
+        r->pos += n;
+        i += n;
+
+        if(end != NULL)
+            break;
+    }
+
+    if(i == 0)
+        return NULL;
+
+    line[i] = '\0';
+    return line;
+}
+
+bool processFile(cluster_t **cluster_arr, obj_t **object_arr, int *arr_size, FILE *f, arguments_t *a)
+{
+    char line[MAX_LARGE_LINE_BUFFER_LENGTH]; // string that contains a line from the file
+    int line_length = a->memory > 0 ? MAX_LARGE_LINE_BUFFER_LENGTH : MAX_LINE_BUFFER_LENGTH;
+    reader_t r = {.f = f};
+
+    if(readLine(&r, line, line_length) != NULL)  // read first line
+    {
+        if(!checkFirstLine(line, arr_size, a) || !allocateObjects(cluster_arr, object_arr, *arr_size, a))
+            return false;
+    }
+    else
+    { // if fgets function returned NULL
+        fprintf(stderr, "Error! File '%s' is empty\n", a->filename);
+        return false;
+    }
+
+    id_set_t ids;  // ids of the objects that were already read
+
+    if(!initIdSet(&ids, *arr_size, a->memory > 0))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for a set of the object ids\n");
+        return false;
+    }
+
+    int line_cnt = 1; // number of the lines in the file
+    long long max_id = a->memory > 0 ? INT_MAX : MAX_CLUSTER_NUMBER;
+    bool result = true;
+
+    while(readLine(&r, line, line_length) != NULL)
+    {
+        // if the program already read specified number of the objects stop reading file
+        if(line_cnt == *arr_size + 1)  // line_cnt == number of objects + 1 (first line 'count=x')
+            break;
+
+        if(!checkObjectLine(line, *object_arr, &ids, line_cnt, max_id))
+        {
+            result = false;
+            break;
+        }
+
+        line_cnt++;
+    }
+
+    destroyIdSet(&ids);
+
+    if(!result)
+        return false;
+
+    // if there are fewer objects than first line specified
+    if(line_cnt != *arr_size + 1)
+    {
+        fprintf(stderr, "Error! Expected %d objects in the file '%s', but got %d\n", *arr_size, a->filename, line_cnt - 1);
+        return false;
+    }
+
+    fclose(f);
+    return true;
+}
+
+// reads one column of the binary file (0 - ids, 1 - x-coordinates, 2 - y-coordinates) to the objects
+bool readColumn(FILE *f, void *block, size_t width, int size, obj_t *objects, int column)
+{
+    size_t items = READ_BLOCK_SIZE / width;
+
+    for(int i = 0; i < size; i += (int) items)
+    {
+        size_t n = (size_t) (size - i) < items ? (size_t) (size - i) : items;
+
+        if(fread(block, width, n, f) != n)
+            return false;
+
+        for(size_t j = 0; j < n; j++)
+        {
+            obj_t *obj = &objects[i + j];
+
+            if(column == 0)
+            {
+                long long id = width == 4 ? (long long) ((uint32_t *) block)[j] : ((int64_t *) block)[j];
+                obj->id = id >= 1 && id <= INT_MAX ? (int) id : -1;  // invalid ids are reported with the other checks
+            }
+            else if(column == 1)
+                obj->x = ((float *) block)[j];
+            else
+                obj->y = ((float *) block)[j];
+        }
+    }
+
+    return true;
+}
+
+// reads the objects from the binary file made by the 'convert' subcommand
+// the objects were checked when the file was made, only their ranges are checked again
+bool processBinaryFile(cluster_t **cluster_arr, obj_t **object_arr, int *arr_size, FILE *f, arguments_t *a)
+{
+    binary_header_t header;
+
+    if(fread(&header, sizeof(binary_header_t), 1, f) != 1 || memcmp(header.magic, BINARY_MAGIC, 4) != 0
+       || header.version != BINARY_VERSION || (header.id_width != 4 && header.id_width != 8)
+       || header.coordinate_type != BINARY_FLOAT32)
+    {
+        fprintf(stderr, "Error! Invalid header of the binary file '%s'\n", a->filename);
+        return false;
+    }
+
+    if(header.count < 1 || header.count > (a->memory > 0 ? INT_MAX : MAX_CLUSTER_NUMBER))
+    {
+        fprintf(stderr, "Error! Number of the objects in the file must be a positive integer\n");
+        return false;
+    }
+
+    *arr_size = (int) header.count;
+
+    if(!allocateObjects(cluster_arr, object_arr, *arr_size, a))
+        return false;
+
+    uint64_t block[READ_BLOCK_SIZE / sizeof(uint64_t)];
+
+    if(!readColumn(f, block, header.id_width, *arr_size, *object_arr, 0)
+       || !readColumn(f, block, sizeof(float), *arr_size, *object_arr, 1)
+       || !readColumn(f, block, sizeof(float), *arr_size, *object_arr, 2))
+    {
+        fprintf(stderr, "Error! Expected %d objects in the file '%s'\n", *arr_size, a->filename);
+        return false;
+    }
+
+    long long max_id = a->memory > 0 ? INT_MAX : MAX_CLUSTER_NUMBER;
+
+    for(int i = 0; i < *arr_size; i++)
+    {
+        obj_t *obj = &(*object_arr)[i];
+
+        // coordinates are integers from the interval [0, 1000] (NaN fails the comparisons)
+        if(obj->id < 1 || obj->id > max_id || !(obj->x >= 0.0 && obj->x <= 1000.0 && obj->y >= 0.0 && obj->y <= 1000.0)
+           || obj->x != (int) obj->x || obj->y != (int) obj->y)
+        {
+            fprintf(stderr, "Error! Invalid object no. %d in the binary file '%s'\n", i + 1, a->filename);
+            return false;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+// writes the objects to the binary file (columns of the ids, x-coordinates and y-coordinates)
+// ids are always written as 32-bit, files with 64-bit ids can be read as long as the ids fit into int
+bool writeBinaryFile(char *filename, obj_t *objects, int size)
+{
+    FILE *f = fopen(filename, "wb");
+
+    if(f == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't open a file '%s'\n", filename);
+        return false;
+    }
+
+    binary_header_t header = {.magic = BINARY_MAGIC, .version = BINARY_VERSION, .count = (uint64_t) size,
+                              .id_width = 4, .coordinate_type = BINARY_FLOAT32};
+
+    bool result = fwrite(&header, sizeof(binary_header_t), 1, f) == 1;
+
+    for(int i = 0; i < size && result; i++)
+    {
+        uint32_t id = (uint32_t) objects[i].id;
+        result = fwrite(&id, sizeof(uint32_t), 1, f) == 1;
+    }
+
+    for(int i = 0; i < size && result; i++)
+        result = fwrite(&objects[i].x, sizeof(float), 1, f) == 1;
+
+    for(int i = 0; i < size && result; i++)
+        result = fwrite(&objects[i].y, sizeof(float), 1, f) == 1;
+
+    if(fclose(f) != 0 || !result)
+    {
+        fprintf(stderr, "Error! Couldn't write a file '%s'\n", filename);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ Ze souboru 'filename' nacte objekty. Pro kazdy objekt vytvori shluk a ulozi
+ jej do pole shluku. Alokuje prostor pro pole vsech shluku a ukazatel na prvni
+ polozku pole (ukalazatel na prvni shluk v alokovanem poli) ulozi do pameti,
+ kam se odkazuje parametr 'arr'. Funkce vraci pocet nactenych objektu (shluku).
+ V pripade nejake chyby uklada do pameti, kam se odkazuje 'arr', hodnotu NULL.
+*/
+
+int load_clusters(cluster_t **cluster_arr, obj_t **object_arr, arguments_t *a)
+{
+    assert(cluster_arr != NULL);
+
+    FILE *f = fopen(a->filename, "r");
+
+    if(f == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't open a file '%s'\n", a->filename);
+        return -1;
+    }
+
+    // number of objects in the object array/number of clusters in cluster array (depends on clustering algorithm)
+    int arr_size = 0;
+
+    // binary files start with the magic bytes, text files with 'count='
+    char magic[4];
+    bool binary = fread(magic, 1, 4, f) == 4 && memcmp(magic, BINARY_MAGIC, 4) == 0;
+
+    if(binary)
+        f = freopen(a->filename, "rb", f);
+    else
+        rewind(f);
+
+    if(f == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't open a file '%s'\n", a->filename);
+        return -1;
+    }
+
+    if(!(binary ? processBinaryFile : processFile)(cluster_arr, object_arr, &arr_size, f, a))
+    {
+        // if some error occurred, only 'required_clusters' clusters need to be freed
+        destroy(*cluster_arr, a->required_clusters, *object_arr);
+        *cluster_arr = NULL;
+        *object_arr = NULL;
+        fclose(f);
+        return -1;
+    }
+
+    return arr_size;
+}
+
+// check if string contains a valid program flag
+// list of the valid flags:
+// '-c' - complete linkage
+// '-a' - average linkage
+// '-k' - k-means
+// '-s' - single linkage
+// '-w' - Ward linkage
+// '-m' - centroid linkage
+bool checkFlag(char *str, char *flag)
+{
+    if(strcmp(str, "-c") == 0 || strcmp(str, "-a") == 0 || strcmp(str, "-k") == 0 || strcmp(str, "-s") == 0 ||
+       strcmp(str, "-w") == 0 || strcmp(str, "-m") == 0)
+    {
+        *flag = str[1];
+        return true;
+    }
+
+    return false;
+}
+
+// checks if string contains an unsigned integer
+bool checkUnsigned(char *str, unsigned long long *number)
+{
+    char *end_ptr;
+
+    if(*str == '\0' || *str == '-')
+        return false;
+
+    *number = strtoull(str, &end_ptr, 10);
+    return *end_ptr == '\0';
+}
+
+// parses comma-separated numbers of the clusters ('2,5,10,50')
+bool parseCuts(char *str, arguments_t *a)
+{
+    a->cut_count = 0;
+
+    while(a->cut_count < MAX_CUTS)
+    {
+        char *end_ptr;
+
+        if(*str < '0' || *str > '9')
+            return false;
+
+        long long number = strtoll(str, &end_ptr, 10);
+
+        if(number < 1 || number > INT_MAX || (*end_ptr != ',' && *end_ptr != '\0'))
+            return false;
+
+        a->cuts[a->cut_count++] = (int) number;
+
+        if(*end_ptr == '\0')
+            return true;
+
+        str = end_ptr + 1;
+    }
+
+    return false;
+}
+
+// parses an option with the value ('--name value')
+// list of the valid options:
+// '--seed S' - seed of the random number generator (k-means), current time is used by default
+// '--threads N' - number of the threads used by the hierarchical clustering algorithms, 1 by default
+// '--memory M' - turns on the large-input mode with the memory budget of M MiB: ids and objects up to INT_MAX,
+//                 single linkage and k-means keep the objects in one array, the input is refused if the chosen
+//                 method would need more memory than M
+// '--linkage FILE' - writes all merges of the hierarchical clustering to the file (linkage matrix)
+// '--cuts LIST' - prints the clusters for every number of the clusters in the comma-separated list,
+//                 the clustering runs only once
+// '--minibatch B' - k-means updates the centroids from the random batches of B objects (mini-batch k-means)
+// '--max-iter N' - maximum number of the iterations of k-means, 300 by default (100 for mini-batch k-means)
+// '--tol T' - k-means stops when no centroid moved more than T, 0 by default
+// '--save-state FILE' - saves the clustering (k-means or single linkage), so new objects can be added to it later
+//                 with './executable insert FILE input'
+// '--format F' - format of the printed clusters: 'text' (default), 'csv', 'json' or 'labels-bin' (the cluster of every
+//                 object, see writeLabels)
+// '--stats-json FILE' - the same as '--stats', the statistics are written to the file as JSON too
+// option '--stats' has no value, it prints the times of the phases of the run and the counters to stderr
+bool parseOption(char *name, char *value, arguments_t *a)
+{
+    unsigned long long number;
+
+    if(value == NULL)
+    {
+        fprintf(stderr, "Error! Missing value of the option '%s'\n", name);
+        return false;
+    }
+
+    if(strcmp(name, "--seed") == 0)
+    {
+        if(checkUnsigned(value, &a->seed))
+            return true;
+
+        fprintf(stderr, "Error! Seed must be an unsigned integer\n");
+        return false;
+    }
+
+    if(strcmp(name, "--threads") == 0)
+    {
+        if(checkUnsigned(value, &number) && number >= 1 && number <= MAX_THREADS)
+        {
+            a->threads = (int) number;
+            return true;
+        }
+
+        fprintf(stderr, "Error! Number of the threads must be an integer from the interval [1, %d]\n", MAX_THREADS);
+        return false;
+    }
+
+    if(strcmp(name, "--memory") == 0)
+    {
+        if(checkUnsigned(value, &a->memory) && a->memory > 0)
+            return true;
+
+        fprintf(stderr, "Error! Memory budget must be a positive integer (MiB)\n");
+        return false;
+    }
+
+    if(strcmp(name, "--linkage") == 0)
+    {
+        a->linkage = value;
+        return true;
+    }
+
+    if(strcmp(name, "--minibatch") == 0 || strcmp(name, "--max-iter") == 0)
+    {
+        int *target = strcmp(name, "--minibatch") == 0 ? &a->minibatch : &a->max_iter;
+
+        if(checkUnsigned(value, &number) && number >= 1 && number <= INT_MAX)
+        {
+            *target = (int) number;
+            return true;
+        }
+
+        fprintf(stderr, "Error! Value of the option '%s' must be an integer from the interval [1, %d]\n", name, INT_MAX);
+        return false;
+    }
+
+    if(strcmp(name, "--tol") == 0)
+    {
+        char *end_ptr;
+        a->tol = strtod(value, &end_ptr);
+
+        if(*value != '\0' && *end_ptr == '\0' && a->tol >= 0.0 && isfinite(a->tol))
+            return true;
+
+        fprintf(stderr, "Error! Tolerance must be a non-negative number\n");
+        return false;
+    }
+
+    if(strcmp(name, "--save-state") == 0 && !a->insert)
+    {
+        a->state = value;
+        return true;
+    }
+
+    if(strcmp(name, "--stats-json") == 0)
+    {
+        a->stats = true;
+        a->stats_file = value;
+        return true;
+    }
+
+    if(strcmp(name, "--format") == 0)
+    {
+        const char *names[] = {"text", "csv", "json", "labels-bin"};
+
+        for(int i = 0; i < 4; i++)
+        {
+            if(strcmp(value, names[i]) == 0)
+            {
+                a->format = "tcjb"[i];
+                return true;
+            }
+        }
+
+        fprintf(stderr, "Error! Format must be 'text', 'csv', 'json' or 'labels-bin'\n");
+        return false;
+    }
+
+    if(strcmp(name, "--cuts") == 0)
+    {
+        if(parseCuts(value, a))
+            return true;
+
+        fprintf(stderr, "Error! Cuts must be a comma-separated list of at most %d positive integers\n", MAX_CUTS);
+        return false;
+    }
+
+    fprintf(stderr, "Error! Unknown option '%s'\n", name);
+    return false;
+}
+
+// ./executable filename [N] [flag] [options]
+// parses program arguments
+// returns false if invalid argument was encountered
+// returns true if all arguments were valid
+bool parseArguments(int argc, char *argv[], arguments_t *a)
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "Error! Invalid number of the program arguments\n");
+        return false;
+    }
+
+    a->filename = argv[1];
+    int first = 2;  // first argument after the filename
+
+    // ./executable convert input output - checks the text file and saves its objects to the binary file
+    if(strcmp(argv[1], "convert") == 0)
+    {
+        if(argc < 4)
+        {
+            fprintf(stderr, "Error! Invalid number of the program arguments\n");
+            return false;
+        }
+
+        a->filename = argv[2];
+        a->output = argv[3];
+        first = 4;
+    }
+
+    // ./executable insert state input - adds the objects from the text/binary file to the saved clustering
+    if(strcmp(argv[1], "insert") == 0)
+    {
+        if(argc < 4)
+        {
+            fprintf(stderr, "Error! Invalid number of the program arguments\n");
+            return false;
+        }
+
+        a->state = argv[2];
+        a->filename = argv[3];
+        a->insert = true;
+        first = 4;
+    }
+
+    // options can be anywhere after the filename
+    // they are parsed first, because the large-input mode changes the maximum number of the clusters
+    for(int i = first; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--stats") == 0)
+            a->stats = true;
+        else if(strncmp(argv[i], "--", 2) == 0)
+        {
+            if(!parseOption(argv[i], i + 1 < argc ? argv[i + 1] : NULL, a))
+                return false;
+
+            i++;
+        }
+    }
+
+    int positional = 0;  // number of the arguments after the filename that are not options
+    bool has_number = false;
+    long long number;
+
+    for(int i = first; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--stats") == 0)
+            continue;
+
+        if(strncmp(argv[i], "--", 2) == 0)
+        {
+            i++;
+            continue;
+        }
+
+        positional++;
+
+        // the conversion and the insertion have no positional arguments after the files
+        if(a->output != NULL || a->insert)
+        {
+            fprintf(stderr, "Error! Invalid number of the program arguments\n");
+            return false;
+        }
+
+        // ./executable filename N or ./executable filename flag
+        if(positional == 1)
+        {
+            if(checkNumber(argv[i], &number, a->memory > 0 ? INT_MAX : MAX_CLUSTER_NUMBER))
+            {
+                a->required_clusters = (int) number;
+                has_number = true;
+                continue;
+            }
+
+            if(checkFlag(argv[i], &a->flag))
+                continue;
+
+            fprintf(stderr, "Error! Invalid third program argument '%s'\n", argv[i]);
+            return false;
+        }
+
+        // ./executable filename N flag
+        if(positional == 2 && has_number)
+        {
+            if(checkFlag(argv[i], &a->flag))
+                continue;
+
+            fprintf(stderr, "Error! Invalid fourth program argument '%s'\n", argv[i]);
+            return false;
+        }
+
+        fprintf(stderr, "Error! Invalid number of the program arguments\n");
+        return false;
+    }
+
+    if((a->linkage != NULL || a->cut_count > 0) && (a->flag == 'k' || a->output != NULL || a->insert))
+    {
+        fprintf(stderr, "Error! Options '--cuts' and '--linkage' need a hierarchical clustering method\n");
+        return false;
+    }
+
+    if((a->minibatch > 0 || a->max_iter > 0 || a->tol > 0.0) && (a->flag != 'k' || a->output != NULL || a->insert))
+    {
+        fprintf(stderr, "Error! Options '--minibatch', '--max-iter' and '--tol' need k-means clustering\n");
+        return false;
+    }
+
+    if(a->state != NULL && !a->insert && ((a->flag != 'k' && a->flag != 's') || a->cut_count > 0 || a->output != NULL))
+    {
+        fprintf(stderr, "Error! Option '--save-state' needs k-means or single linkage clustering\n");
+        return false;
+    }
+
+    if(a->format != 't' && (a->cut_count > 0 || a->output != NULL || a->insert))
+    {
+        fprintf(stderr, "Error! Option '--format' can't be used with '--cuts', 'convert' or 'insert'\n");
+        return false;
+    }
+
+    if(a->cut_count > 0)
+    {
+        if(has_number)
+        {
+            fprintf(stderr, "Error! Option '--cuts' replaces the number of the clusters\n");
+            return false;
+        }
+
+        // the clusters are allocated for the biggest cut
+        for(int i = 0; i < a->cut_count; i++)
+            if(a->cuts[i] > a->required_clusters)
+                a->required_clusters = a->cuts[i];
+    }
+
+    return true;
+}
+
+// waits for the tasks and runs them
+void *poolWorker(void *arg)
+{
+    pool_t *pool = (pool_t *) arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    int index = ++pool->started;
+    unsigned long generation = 0;  // the thread could start after the first task was added
+
+    pthread_once(&key_once, createKeys);
+    pthread_setspecific(distance_key, &pool->distances[index]);
+
+    while(true)
+    {
+        while(!pool->stop && pool->generation == generation)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+
+        if(pool->stop)
+            break;
+
+        generation = pool->generation;
+        taskFunction task = pool->task;
+        void *context = pool->context;
+
+        pthread_mutex_unlock(&pool->lock);
+        task(context, index, pool->threads);
+        pthread_mutex_lock(&pool->lock);
+
+        if(--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// stops and joins the worker threads and frees a memory that was allocated for the pool
+void destroyPool(pool_t *pool)
+{
+    if(pool->workers == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->threads - 1; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->distances);
+    pool->workers = NULL;
+    pool->distances = NULL;
+}
+
+// starts 'threads' - 1 worker threads (the main thread is the thread with index 0)
+bool initPool(pool_t *pool, int threads)
+{
+    *pool = (pool_t) {.threads = threads};
+
+    if(threads == 1)
+        return true;
+
+    pool->workers = (pthread_t *) countedMalloc(sizeof(pthread_t) * (threads - 1));
+    pool->distances = (unsigned long long *) countedCalloc(threads, sizeof(unsigned long long));
+
+    if(pool->workers == NULL || pool->distances == NULL)
+    {
+        free(pool->workers);
+        free(pool->distances);
+        pool->workers = NULL;
+        pool->distances = NULL;
+        return false;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for(int i = 0; i < threads - 1; i++)
+    {
+        if(pthread_create(&pool->workers[i], NULL, poolWorker, pool) != 0)
+        {
+            pool->threads = i + 1;  // join only the threads that were started
+            destroyPool(pool);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// runs the task on all threads of the pool and waits until all threads finish it
+void runParallel(pool_t *pool, taskFunction task, void *context)
+{
+    if(pool->threads == 1)
+    {
+        task(context, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->running = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(context, 0, pool->threads);
+
+    pthread_mutex_lock(&pool->lock);
+
+    while(pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    // all workers finished the task, so their counters are added without a race
+    for(int i = 1; i < pool->threads; i++)
+    {
+        stats.distances += pool->distances[i];
+        pool->distances[i] = 0;
+    }
+}
+
+// allocates a memory for the coordinates of 'size' points
+bool initPoints(points_t *p, int size)
+{
+    p->size = size;
+    p->x = (float *) scratchMalloc(sizeof(float) * size);
+    p->y = (float *) scratchMalloc(sizeof(float) * size);
+
+    if(p->x == NULL || p->y == NULL)
+    {
+        scratchFree(p->x);
+        scratchFree(p->y);
+        p->x = p->y = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+// frees a memory that was allocated for the points
+void destroyPoints(points_t *p)
+{
+    scratchFree(p->x);
+    scratchFree(p->y);
+    p->x = p->y = NULL;
+    p->size = 0;
+}
+
+// computes the squared distances from the point [x, y] to the points from .. to - 1 and saves them to 'result'
+// the vector version computes 4 distances at once with the same rounding as the scalar version
+void squaredDistances(points_t *p, float x, float y, int from, int to, float *result)
+{
+    countDistances(to - from);
+
+    int i = from;
+
+#ifdef __SSE2__
+    __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y);
+
+    for(; i + 4 <= to; i += 4)
+    {
+        __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(p->x + i));
+        __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(p->y + i));
+        _mm_storeu_ps(result + i - from, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+    }
+#endif
+
+    for(; i < to; i++)
+        result[i - from] = (x - p->x[i]) * (x - p->x[i]) + (y - p->y[i]) * (y - p->y[i]);
+}
+
+// replaces the squared distances with the distances
+void rootDistances(float *dist, int size)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for(; i + 4 <= size; i += 4)
+        _mm_storeu_ps(dist + i, _mm_sqrt_ps(_mm_loadu_ps(dist + i)));
+#endif
+
+    for(; i < size; i++)
+        dist[i] = sqrt(dist[i]);
+}
+
+// lowers the squared distances 'dist' of the points from .. to - 1 to the squared distances to the point 'last'
+// if they are smaller and saves 'last' as the nearest point of the points that were updated
+void relaxDistances(points_t *p, int last, int from, int to, float *dist, int *nearest)
+{
+    countDistances(to - from);
+
+    float x = p->x[last], y = p->y[last];
+    int i = from;
+
+#ifdef __SSE2__
+    __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y);
+    __m128i l = _mm_set1_epi32(last);
+
+    for(; i + 4 <= to; i += 4)
+    {
+        __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(p->x + i));
+        __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(p->y + i));
+        __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 old = _mm_loadu_ps(dist + i);
+        __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, old));
+        __m128i n = _mm_loadu_si128((__m128i *) (nearest + i));
+
+        _mm_storeu_ps(dist + i, _mm_min_ps(d, old));
+        _mm_storeu_si128((__m128i *) (nearest + i), _mm_or_si128(_mm_and_si128(closer, l), _mm_andnot_si128(closer, n)));
+    }
+#endif
+
+    for(; i < to; i++)
+    {
+        float d = (x - p->x[i]) * (x - p->x[i]) + (y - p->y[i]) * (y - p->y[i]);
+
+        if(d < dist[i])
+        {
+            dist[i] = d;
+            nearest[i] = last;
+        }
+    }
+}
+
+// returns the row/column of the cell that contains the coordinate
+int gridCell(grid_t *g, float coordinate)
+{
+    int cell = (int) (coordinate / g->cell_size);
+
+    if(cell < 0)
+        return 0;
+
+    if(cell >= g->cols)
+        return g->cols - 1;
+
+    return cell;
+}
+
+// sorts the objects into the cells of the grid
+// has to be called again every time coordinates of the indexed objects change
+void fillGrid(grid_t *g)
+{
+    int cells = g->cols * g->cols;
+
+    for(int i = 0; i <= cells; i++)
+        g->cell_start[i] = 0;
+
+    // count the objects in every cell (objects with invalid coordinates are not indexed)
+    for(int i = 0; i < g->size; i++)
+        if(!isnan(g->objects[i].x) && !isnan(g->objects[i].y))
+            g->cell_start[gridCell(g, g->objects[i].y) * g->cols + gridCell(g, g->objects[i].x) + 1]++;
+
+    for(int i = 0; i < cells; i++)
+        g->cell_start[i + 1] += g->cell_start[i];
+
+    // cell_start[c] is used as the position of the next object of the cell c and then shifted back
+    for(int i = 0; i < g->size; i++)
+        if(!isnan(g->objects[i].x) && !isnan(g->objects[i].y))
+            g->items[g->cell_start[gridCell(g, g->objects[i].y) * g->cols + gridCell(g, g->objects[i].x)]++] = i;
+
+    for(int i = cells; i > 0; i--)
+        g->cell_start[i] = g->cell_start[i - 1];
+
+    g->cell_start[0] = 0;
+}
+
+// initializes the grid over the array of the objects
+bool initGrid(grid_t *g, obj_t *objects, int size)
+{
+    g->objects = objects;
+    g->size = size;
+    g->cols = (int) sqrt(size / GRID_OBJECTS_PER_CELL);
+
+    if(g->cols < 1)
+        g->cols = 1;
+
+    g->cell_size = GRID_SIZE / g->cols;
+    g->cell_start = (int *) scratchMalloc(sizeof(int) * (g->cols * g->cols + 1));
+    g->items = (int *) scratchMalloc(sizeof(int) * (size + 1));  // + 1 in order to not call malloc with zero size
+
+    // the pointers are cleared, so destroyGrid can be called after the failure too
+    if(g->cell_start == NULL || g->items == NULL)
+    {
+        scratchFree(g->cell_start);
+        scratchFree(g->items);
+        g->cell_start = g->items = NULL;
+        return false;
+    }
+
+    fillGrid(g);
+    return true;
+}
+
+// frees a memory that was allocated for the grid
+void destroyGrid(grid_t *g)
+{
+    scratchFree(g->cell_start);
+    scratchFree(g->items);
+    g->cell_start = g->items = NULL;
+}
+
+// finds the nearest indexed object to the object 'obj', the cells are searched in the rings around the cell of 'obj'
+// if there are more nearest objects, the object with the smallest index is taken
+// returns the index of the nearest object (-1 if there are no indexed objects) and saves the distance to 'distance'
+int gridNearest(grid_t *g, obj_t *obj, float *distance)
+{
+    int nearest = -1;
+    float min = MAX_CLUSTER_DISTANCE;
+
+    int cx = gridCell(g, obj->x), cy = gridCell(g, obj->y);
+
+    // objects in the ring r are at least (r - 1) cells far
+    for(int r = 0; r <= g->cols && (r == 0 || (r - 1) * g->cell_size <= min + GRID_EPSILON); r++)
+    {
+        for(int y = cy - r; y <= cy + r; y++)
+        {
+            if(y < 0 || y >= g->cols)
+                continue;
+
+            // inside of the ring was already searched, so only first and last cell of the inner rows are searched
+            int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+
+            for(int x = cx - r; x <= cx + r; x += step)
+            {
+                if(x < 0 || x >= g->cols)
+                    continue;
+
+                int cell = y * g->cols + x;
+
+                countDistances(g->cell_start[cell + 1] - g->cell_start[cell]);
+
+                for(int i = g->cell_start[cell]; i < g->cell_start[cell + 1]; i++)
+                {
+                    int idx = g->items[i];
+                    float d = obj_distance(obj, &g->objects[idx]);
+
+                    if(d < min || (d == min && idx < nearest))
+                    {
+                        min = d;
+                        nearest = idx;
+                    }
+                }
+            }
+        }
+    }
+
+    *distance = min;
+    return nearest;
+}
+
+// finds all indexed objects that are at most 'radius' far from the object 'obj' and saves their indexes to 'result'
+// (it has to have space for all indexed objects)
+// returns the number of the found objects
+int gridRadius(grid_t *g, obj_t *obj, float radius, int *result)
+{
+    int found = 0;
+
+    int x0 = gridCell(g, obj->x - radius - GRID_EPSILON), x1 = gridCell(g, obj->x + radius + GRID_EPSILON);
+    int y0 = gridCell(g, obj->y - radius - GRID_EPSILON), y1 = gridCell(g, obj->y + radius + GRID_EPSILON);
+
+    for(int y = y0; y <= y1; y++)
+    {
+        for(int x = x0; x <= x1; x++)
+        {
+            int cell = y * g->cols + x;
+
+            countDistances(g->cell_start[cell + 1] - g->cell_start[cell]);
+
+            for(int i = g->cell_start[cell]; i < g->cell_start[cell + 1]; i++)
+                if(obj_distance(obj, &g->objects[g->items[i]]) <= radius)
+                    result[found++] = g->items[i];
+        }
+    }
+
+    return found;
+}
+
+// frees a memory that was allocated for the groups of the objects with the same coordinates
+void destroyDuplicates(duplicates_t *d)
+{
+    scratchFree(d->objects);
+    scratchFree(d->weight);
+    scratchFree(d->first);
+    scratchFree(d->group);
+    *d = (duplicates_t) {0};
+}
+
+// divides the objects into the groups of the objects with the same coordinates (hash table of the coordinates)
+// returns false if there are no two objects with the same coordinates or there is not enough memory,
+// the objects are clustered without collapsing then
+bool collapseDuplicates(duplicates_t *d, obj_t *objects, int n)
+{
+    size_t slots = 1;
+
+    while(slots < 2 * (size_t) n)
+        slots *= 2;
+
+    *d = (duplicates_t) {0};
+
+    int *table = (int *) scratchMalloc(sizeof(int) * slots);  // group of every slot, -1 if the slot is empty
+    d->objects = (obj_t *) scratchMalloc(sizeof(obj_t) * n);
+    d->weight = (int *) scratchMalloc(sizeof(int) * n);
+    d->first = (int *) scratchMalloc(sizeof(int) * n);
+    d->group = (int *) scratchMalloc(sizeof(int) * n);
+
+    if(table == NULL || d->objects == NULL || d->weight == NULL || d->first == NULL || d->group == NULL)
+    {
+        scratchFree(table);
+        destroyDuplicates(d);
+        return false;
+    }
+
+    for(size_t i = 0; i < slots; i++)
+        table[i] = -1;
+
+    for(int i = 0; i < n; i++)
+    {
+        // coordinates are integers from the interval [0, 1000]
+        size_t key = (size_t) objects[i].x * 1001 + (size_t) objects[i].y;
+        size_t slot = (key * 2654435761u) & (slots - 1);
+
+        while(table[slot] != -1 && (d->objects[table[slot]].x != objects[i].x || d->objects[table[slot]].y != objects[i].y))
+            slot = (slot + 1) & (slots - 1);
+
+        if(table[slot] == -1)
+        {
+            table[slot] = d->size;
+            d->objects[d->size] = objects[i];
+            d->weight[d->size] = 0;
+            d->first[d->size++] = i;
+        }
+
+        d->group[i] = table[slot];
+        d->weight[table[slot]]++;
+    }
+
+    scratchFree(table);
+
+    if(d->size == n)
+    {
+        destroyDuplicates(d);
+        return false;
+    }
+
+    return true;
+}
+
+// calculates the distance between two objects/centroids in double precision (used for the bounds)
+double centroidDistance(obj_t *c1, obj_t *c2)
+{
+    double dx = (double) c1->x - c2->x, dy = (double) c1->y - c2->y;
+    return sqrt(dx * dx + dy * dy);
+}
+
+// returns the next random number (splitmix64)
+uint64_t nextRandom(random_t *r)
+{
+    uint64_t z = (r->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// returns a random number from the interval [0, 1)
+double randomDouble(random_t *r)
+{
+    return (nextRandom(r) >> 11) * (1.0 / 9007199254740992.0);  // 53 bits of the random number / 2^53
+}
+
+// chooses the objects that will become the first centroids (k-means++)
+// the first centroid is chosen randomly, every next centroid is chosen with the probability proportional to
+// the squared distance of the object to the nearest chosen centroid, so the centroids are spread over the objects
+// 'min_dist' is used as a temporary array
+void chooseCentroids(obj_t *centroid_arr, int centroid_arr_size, obj_t *object_arr, int object_arr_size, double *min_dist, random_t *r)
+{
+    int chosen = (int) (randomDouble(r) * object_arr_size);
+
+    for(int i = 0; i < object_arr_size; i++)
+        min_dist[i] = INFINITY;
+
+    for(int c = 0; c < centroid_arr_size; c++)
+    {
+        centroid_arr[c] = object_arr[chosen];
+
+        double total = 0.0;  // sum of the squared distances to the nearest chosen centroid
+
+        countDistances(object_arr_size);
+
+        for(int i = 0; i < object_arr_size; i++)
+        {
+            double distance = centroidDistance(&object_arr[i], &centroid_arr[c]);
+
+            if(distance * distance < min_dist[i])
+                min_dist[i] = distance * distance;
+
+            total += min_dist[i];
+        }
+
+        double target = randomDouble(r) * total;
+        chosen = -1;
+
+        for(int i = 0; i < object_arr_size && chosen == -1; i++)
+        {
+            target -= min_dist[i];
+
+            if(target < 0.0)
+                chosen = i;
+        }
+
+        // all objects are at the same place as some chosen centroid (or rounding), the farthest object is taken
+        if(chosen == -1)
+        {
+            chosen = 0;
+
+            for(int i = 1; i < object_arr_size; i++)
+                if(min_dist[i] > min_dist[chosen])
+                    chosen = i;
+        }
+    }
+}
+
+// initializes centroid array
+bool initializeCentroids(obj_t **centroid_arr, int centroid_arr_size, obj_t *object_arr, int object_arr_size, random_t *r)
+{
+    *centroid_arr = (obj_t *) scratchMalloc(sizeof(obj_t) * centroid_arr_size); // allocate memory for centroid arr
+
+    if(*centroid_arr == NULL) // check if allocation was successfully
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for an array of centroids\n");
+        return false;
+    }
+
+    // squared distance of every object to the nearest centroid
+    double *min_dist = (double *) scratchMalloc(sizeof(double) * object_arr_size);
+
+    if(min_dist == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for an array of distances\n");
+        scratchFree(*centroid_arr); // free memory that was allocated for a centroid array
+        return false;
+    }
+
+    chooseCentroids(*centroid_arr, centroid_arr_size, object_arr, object_arr_size, min_dist, r);
+
+    scratchFree(min_dist);
+    return true;
+}
+
+// finds the nearest centroid to the object (the first of them if there are more)
+// saves the distance to the nearest centroid to 'min' and the distance to the second nearest centroid to 'second'
+int findNearestCentroid(obj_t *obj, obj_t *centroid_arr, int centroid_arr_size, float *min, float *second)
+{
+    int nearest = -1;
+    *min = *second = INFINITY;  // squared distances until the end
+
+    countDistances(centroid_arr_size);
+
+    for(int i = 0; i < centroid_arr_size; i++)
+    {
+        float distance = squaredDistance(obj, &centroid_arr[i]);
+
+        if(distance < *min)
+        {
+            *second = *min;
+            *min = distance;
+            nearest = i;
+        }
+        else if(distance < *second)
+            *second = distance;
+    }
+
+    *min = sqrt(*min);
+    *second = sqrt(*second);
+    return nearest;
+}
+
+// allocates a memory for the state of k-means, all objects are unassigned and all clusters are empty
+bool initKMeans(kmeans_t *km, int object_arr_size, int centroid_arr_size, int threads)
+{
+    km->threads = threads;
+    km->part_x = (long long *) scratchMalloc(sizeof(long long) * threads * centroid_arr_size);
+    km->part_y = (long long *) scratchMalloc(sizeof(long long) * threads * centroid_arr_size);
+    km->part_count = (int *) scratchMalloc(sizeof(int) * threads * centroid_arr_size);
+    km->label = (int *) scratchMalloc(sizeof(int) * object_arr_size);
+    km->upper = (double *) scratchMalloc(sizeof(double) * object_arr_size);
+    km->lower = (double *) scratchMalloc(sizeof(double) * object_arr_size);
+    km->half_gap = (double *) scratchMalloc(sizeof(double) * centroid_arr_size);
+    km->drift = (double *) scratchMalloc(sizeof(double) * centroid_arr_size);
+    km->previous = (obj_t *) scratchMalloc(sizeof(obj_t) * centroid_arr_size);
+    km->sum_x = (long long *) scratchCalloc(centroid_arr_size, sizeof(long long));
+    km->sum_y = (long long *) scratchCalloc(centroid_arr_size, sizeof(long long));
+    km->count = (int *) scratchCalloc(centroid_arr_size, sizeof(int));
+    km->weight = NULL;
+
+    if(km->label == NULL || km->upper == NULL || km->lower == NULL || km->half_gap == NULL || km->drift == NULL ||
+       km->previous == NULL || km->sum_x == NULL || km->sum_y == NULL || km->count == NULL || km->part_x == NULL ||
+       km->part_y == NULL || km->part_count == NULL)
+        return false;
+
+    for(int i = 0; i < object_arr_size; i++)
+        km->label[i] = -1;
+
+    return true;
+}
+
+// frees a memory that was allocated for the state of k-means
+void destroyKMeans(kmeans_t *km)
+{
+    scratchFree(km->label);
+    scratchFree(km->upper);
+    scratchFree(km->lower);
+    scratchFree(km->half_gap);
+    scratchFree(km->drift);
+    scratchFree(km->previous);
+    scratchFree(km->sum_x);
+    scratchFree(km->sum_y);
+    scratchFree(km->count);
+    scratchFree(km->part_x);
+    scratchFree(km->part_y);
+    scratchFree(km->part_count);
+}
+
+// finds how far the centroids moved after the update ('previous' contains centroids before the update)
+// and the distances between them, the bounds of the objects are moved by the next assignment
+// all centroids are valid points, empty clusters were already moved to objects by reseedEmptyClusters
+void updateBounds(kmeans_t *km, obj_t *centroid_arr, int centroid_arr_size)
+{
+    double max_drift = 0.0;
+
+    countDistances((unsigned long long) centroid_arr_size * (centroid_arr_size + 1));
+
+    for(int i = 0; i < centroid_arr_size; i++)
+    {
+        km->drift[i] = centroidDistance(&km->previous[i], &centroid_arr[i]);
+
+        if(km->drift[i] > max_drift)
+            max_drift = km->drift[i];
+
+        km->half_gap[i] = MAX_CLUSTER_DISTANCE;
+
+        for(int j = 0; j < centroid_arr_size; j++)
+        {
+            double distance = centroidDistance(&centroid_arr[i], &centroid_arr[j]) / 2.0;
+
+            if(j != i && distance < km->half_gap[i])
+                km->half_gap[i] = distance;
+        }
+    }
+
+    km->max_drift = max_drift;
+}
+
+// moves the object to the cluster 'label' and adds the changes of the sums of both clusters to the partial sums
+// returns true if the object was moved from another cluster
+bool moveObject(kmeans_t *km, obj_t *obj, int idx, int label, long long *sum_x, long long *sum_y, int *count)
+{
+    int previous = km->label[idx];
+    int weight = km->weight != NULL ? km->weight[idx] : 1;
+
+    if(previous == label)
+        return false;
+
+    if(previous != -1)
+    {
+        sum_x[previous] -= (long long) obj->x * weight;
+        sum_y[previous] -= (long long) obj->y * weight;
+        count[previous] -= weight;
+    }
+
+    sum_x[label] += (long long) obj->x * weight;
+    sum_y[label] += (long long) obj->y * weight;
+    count[label] += weight;
+    km->label[idx] = label;
+
+    return previous != -1;
+}
+
+// assigns the part of the objects of one thread to the clusters
+void assignTask(void *context, int thread, int threads)
+{
+    assign_task_t *t = (assign_task_t *) context;
+    kmeans_t *km = t->km;
+    obj_t *object_arr = t->object_arr, *centroid_arr = t->centroid_arr;
+    int required_clusters = t->required_clusters;
+
+    int from = (int) ((long long) t->object_arr_size * thread / threads);
+    int to = (int) ((long long) t->object_arr_size * (thread + 1) / threads);
+
+    long long *sum_x = km->part_x + (size_t) thread * required_clusters;
+    long long *sum_y = km->part_y + (size_t) thread * required_clusters;
+    int *count = km->part_count + (size_t) thread * required_clusters;
+
+    memset(sum_x, 0, sizeof(long long) * required_clusters);
+    memset(sum_y, 0, sizeof(long long) * required_clusters);
+    memset(count, 0, sizeof(int) * required_clusters);
+
+    t->failed[thread] = false;
+    t->moved[thread] = 0;
+
+    for(int i = from; i < to; i++)
+    {
+        float min, second;
+        int nearest = km->label[i];
+
+        if(t->first)
+        {
+            nearest = gridNearest(t->grid, &object_arr[i], &min);
+            km->upper[i] = min + BOUND_EPSILON;
+            km->lower[i] = 0.0;
+        }
+        else
+        {
+            // move the bounds by the last update of the centroids
+            km->upper[i] += km->drift[nearest];
+            km->lower[i] -= km->max_drift;
+
+            double bound = km->half_gap[nearest] > km->lower[i] ? km->half_gap[nearest] : km->lower[i];
+
+            if(km->upper[i] + BOUND_EPSILON >= bound)
+            {
+                // tighten the upper bound
+                countDistances(1);
+                km->upper[i] = obj_distance(&object_arr[i], &centroid_arr[nearest]) + BOUND_EPSILON;
+
+                if(km->upper[i] + BOUND_EPSILON >= bound)
+                {
+                    nearest = findNearestCentroid(&object_arr[i], centroid_arr, required_clusters, &min, &second);
+                    km->upper[i] = min + BOUND_EPSILON;
+                    km->lower[i] = second - BOUND_EPSILON;
+                }
+            }
+        }
+
+        if(nearest == -1)
+        {
+            t->failed[thread] = true;
+            return;
+        }
+
+        if(moveObject(km, &object_arr[i], i, nearest, sum_x, sum_y, count))
+            t->moved[thread]++;
+    }
+}
+
+// assigns every object to the cluster with the nearest centroid (the first of them if there are more)
+// in the first assignment the nearest centroids are searched in the grid over the centroid array,
+// later ('grid' can be NULL) only objects whose bounds don't guarantee that their nearest centroid is the same are checked
+// the threads assign the parts of the objects, their partial sums are added in the order of the threads
+// (sums are integers, so the result doesn't depend on the number of the threads)
+bool assignObjectsToClusters(obj_t *object_arr, int object_arr_size, obj_t *centroid_arr, int required_clusters,
+                             grid_t *grid, kmeans_t *km, bool first, pool_t *pool)
+{
+    assert(km->threads == pool->threads);
+
+    assign_task_t t = {.object_arr = object_arr, .object_arr_size = object_arr_size, .centroid_arr = centroid_arr,
+                       .required_clusters = required_clusters, .grid = grid, .km = km, .first = first};
+
+    runParallel(pool, assignTask, &t);
+
+    bool result = true;
+
+    for(int thread = 0; thread < km->threads; thread++)
+    {
+        size_t part = (size_t) thread * required_clusters;
+
+        for(int c = 0; c < required_clusters; c++)
+        {
+            km->sum_x[c] += km->part_x[part + c];
+            km->sum_y[c] += km->part_y[part + c];
+            km->count[c] += km->part_count[part + c];
+        }
+
+        result = result && !t.failed[thread];
+
+        if(stats.enabled)
+            stats.reassignments += t.moved[thread];
+    }
+
+    if(stats.enabled)
+        stats.iterations++;
+
+    return result;
+}
+
+// updates cluster centroid, it is the average of the coordinates of the cluster objects
+// if centroid wasn't updates returns false, otherwise returns true
+bool updateClusterCentroid(obj_t *centroid, long long sum_x, long long sum_y, int count)
+{
+    obj_t tmp = *centroid;
+
+    centroid->x = (float) sum_x / (float) count;
+    centroid->y = (float) sum_y / (float) count;
+
+    if(tmp.x != centroid->x || tmp.y != centroid->y)
+        return true;
+
+    return false;
+}
+
+// moves the centroids of the empty clusters to the objects that are the farthest from their centroids
+// (the first of them if there are more), every moved centroid is taken as the centroid of its object for the next ones,
+// so the centroids are moved to different objects and every object starts a new cluster in the next assignment
+bool reseedEmptyClusters(obj_t *object_arr, int object_arr_size, obj_t *centroid_arr, int required_clusters, kmeans_t *km)
+{
+    double *distance = (double *) scratchMalloc(sizeof(double) * object_arr_size);  // distance to the nearest known centroid
+
+    if(distance == NULL)
+        return false;
+
+    countDistances(object_arr_size);
+
+    for(int i = 0; i < object_arr_size; i++)
+        distance[i] = centroidDistance(&object_arr[i], &centroid_arr[km->label[i]]);
+
+    for(int c = 0; c < required_clusters; c++)
+    {
+        if(km->count[c] > 0)
+            continue;
+
+        int farthest = 0;
+
+        for(int i = 1; i < object_arr_size; i++)
+            if(distance[i] > distance[farthest])
+                farthest = i;
+
+        centroid_arr[c].x = object_arr[farthest].x;
+        centroid_arr[c].y = object_arr[farthest].y;
+        countDistances(object_arr_size);
+
+        for(int i = 0; i < object_arr_size; i++)
+        {
+            double d = centroidDistance(&object_arr[i], &centroid_arr[c]);
+
+            if(d < distance[i])
+                distance[i] = d;
+        }
+    }
+
+    scratchFree(distance);
+    return true;
+}
+
+// updates all cluster centroids, centroids of the empty clusters are moved to the farthest objects
+// 'moved' is set to the longest move of a centroid
+bool updateClusterCentroids(obj_t *object_arr, int object_arr_size, obj_t *centroid_arr, int required_clusters, kmeans_t *km,
+                            double *moved)
+{
+    bool empty = false;
+
+    for(int c = 0; c < required_clusters; c++)
+    {
+        if(km->count[c] > 0)
+            updateClusterCentroid(&centroid_arr[c], km->sum_x[c], km->sum_y[c], km->count[c]);
+        else
+            empty = true;
+    }
+
+    if(empty && !reseedEmptyClusters(object_arr, object_arr_size, centroid_arr, required_clusters, km))
+        return false;
+
+    *moved = 0.0;
+    countDistances(required_clusters);
+
+    for(int c = 0; c < required_clusters; c++)
+    {
+        double distance = centroidDistance(&km->previous[c], &centroid_arr[c]);
+
+        if(distance > *moved)
+            *moved = distance;
+    }
+
+    return true;
+}
+
+// copies the objects to their clusters, objects in the cluster are in the same order as in the object array
+// if the labels are the labels of the groups of the objects with the same coordinates, 'group' is the group of every object
+bool fillClusters(obj_t *object_arr, int object_arr_size, cluster_t *cluster_arr, int required_clusters, kmeans_t *km, int *group)
+{
+    for(int i = 0; i < required_clusters; i++)
+        if(resize_cluster(&cluster_arr[i], km->count[i]) == NULL)
+            return false;
+
+    for(int i = 0; i < object_arr_size; i++)
+        if(append_cluster(&cluster_arr[km->label[group != NULL ? group[i] : i]], object_arr[i]) == NULL)
+            return false;
+
+    return true;
+}
+
+// implementation of k-means clustering algorithm
+// clusters are represented only by the labels of the objects until the algorithm finishes
+// distances to the centroids are computed only for the objects whose nearest centroid could have changed
+// (Hamerly's algorithm), assignments are the same as if all distances were computed
+// stops after 'max_iter' iterations or when no centroid moved more than 'tol'
+// objects with the same coordinates are always in the same cluster, so if 'd' isn't NULL, only one object of every group
+// is assigned with the weight of the group (centroids are chosen from all objects, so they are the same)
+bool kMeansClustering(obj_t *object_arr, int object_arr_size, duplicates_t *d, cluster_t *cluster_arr, int required_clusters,
+                      unsigned long long seed, int max_iter, double tol, pool_t *pool)
+{
+    obj_t *centroid_arr = NULL; // an array of centroids
+    grid_t grid; // grid over the centroids
+    kmeans_t km; // labels of the objects, sums of the clusters and bounds of the distances
+    random_t r = {.state = seed};
+
+    if(!initializeCentroids(&centroid_arr, required_clusters, object_arr, object_arr_size, &r))
+        return false;
+
+    obj_t *assigned = d != NULL ? d->objects : object_arr;  // objects that are assigned to the clusters
+    int assigned_size = d != NULL ? d->size : object_arr_size;
+
+    if(!initKMeans(&km, assigned_size, required_clusters, pool->threads) || !initGrid(&grid, centroid_arr, required_clusters))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for a grid of centroids/labels of the objects\n");
+        destroyKMeans(&km);
+        scratchFree(centroid_arr);
+        return false;
+    }
+
+    // make a first assignment of the objects to the clusters
+    km.weight = d != NULL ? d->weight : NULL;
+    bool result = assignObjectsToClusters(assigned, assigned_size, centroid_arr, required_clusters, &grid, &km, true, pool);
+
+    destroyGrid(&grid);  // only the first assignment uses the grid
+    memcpy(km.previous, centroid_arr, sizeof(obj_t) * required_clusters);
+
+    bool reseeded = true;  // false if there was no memory for moving the centroids of the empty clusters
+
+    // reassign objects to centroids until centroids don't move, the first assignment is the first iteration
+    for(int iteration = 1; iteration < max_iter && result; iteration++)
+    {
+        double moved = 0.0;  // the longest move of a centroid
+
+        if(!(reseeded = updateClusterCentroids(assigned, assigned_size, centroid_arr, required_clusters, &km, &moved)))
+            result = false;
+
+        if(!result || moved <= tol)
+            break;
+
+        updateBounds(&km, centroid_arr, required_clusters);
+        memcpy(km.previous, centroid_arr, sizeof(obj_t) * required_clusters);
+
+        result = assignObjectsToClusters(assigned, assigned_size, centroid_arr, required_clusters, NULL, &km, false, pool);
+    }
+
+    if(!reseeded)
+        fprintf(stderr, "Error! Couldn't allocate memory for moving the centroids of the empty clusters\n");
+    else if(!result)
+        fprintf(stderr, "Error! Couldn't assign an object to the cluster\n");
+    else if(!fillClusters(object_arr, object_arr_size, cluster_arr, required_clusters, &km, d != NULL ? d->group : NULL))
+    {
+        fprintf(stderr, "Error! Couldn't add an object to the cluster\n");
+        result = false;
+    }
+
+    destroyKMeans(&km);
+    scratchFree(centroid_arr);
+    return result;
+}
+
+// implementation of mini-batch k-means clustering algorithm
+// every iteration assigns 'batch' random objects to the nearest centroids and then moves every centroid towards
+// its objects, the learning rate of the centroid is 1 / (number of the objects the centroid got in all batches)
+// stops after 'max_iter' iterations or when no centroid moved more than 'tol', final clusters are made by one
+// assignment of all objects, so the whole object array is read only a few times
+bool miniBatchKMeans(obj_t *object_arr, int object_arr_size, cluster_t *cluster_arr, int required_clusters,
+                     unsigned long long seed, int batch, int max_iter, double tol, pool_t *pool)
+{
+    obj_t *centroid_arr = NULL; // an array of centroids
+    grid_t grid = {0}; // grid over the centroids
+    kmeans_t km; // labels of the objects and sizes of the final clusters
+    random_t r = {.state = seed};
+
+    if(!initializeCentroids(&centroid_arr, required_clusters, object_arr, object_arr_size, &r))
+        return false;
+
+    double *cx = (double *) scratchMalloc(sizeof(double) * required_clusters);  // exact coordinates of the centroids
+    double *cy = (double *) scratchMalloc(sizeof(double) * required_clusters);
+    int *seen = (int *) scratchCalloc(required_clusters, sizeof(int));  // number of the objects the centroid got
+    int *batch_idx = (int *) scratchMalloc(sizeof(int) * batch);  // objects of the batch
+    int *batch_label = (int *) scratchMalloc(sizeof(int) * batch);  // nearest centroids of the objects of the batch
+
+    bool result = initKMeans(&km, object_arr_size, required_clusters, pool->threads) && cx != NULL && cy != NULL && seen != NULL &&
+                  batch_idx != NULL && batch_label != NULL && initGrid(&grid, centroid_arr, required_clusters);
+
+    if(!result)
+        fprintf(stderr, "Error! Couldn't allocate memory for a grid of centroids/labels of the objects\n");
+
+    for(int c = 0; c < required_clusters && result; c++)
+    {
+        cx[c] = centroid_arr[c].x;
+        cy[c] = centroid_arr[c].y;
+    }
+
+    for(int iteration = 0; iteration < max_iter && result; iteration++)
+    {
+        if(stats.enabled)
+            stats.iterations++;
+
+        // all objects of the batch are assigned to the centroids from the start of the iteration
+        for(int b = 0; b < batch; b++)
+        {
+            float min;
+
+            batch_idx[b] = (int) (randomDouble(&r) * object_arr_size);
+            batch_label[b] = gridNearest(&grid, &object_arr[batch_idx[b]], &min);
+        }
+
+        for(int b = 0; b < batch; b++)
+        {
+            int c = batch_label[b];
+            double rate = 1.0 / ++seen[c];
+
+            cx[c] += rate * (object_arr[batch_idx[b]].x - cx[c]);
+            cy[c] += rate * (object_arr[batch_idx[b]].y - cy[c]);
+        }
+
+        double moved = 0.0;  // the longest move of a centroid
+
+        countDistances(required_clusters);
+
+        for(int c = 0; c < required_clusters; c++)
+        {
+            obj_t previous = centroid_arr[c];
+
+            centroid_arr[c].x = (float) cx[c];
+            centroid_arr[c].y = (float) cy[c];
+
+            double distance = centroidDistance(&previous, &centroid_arr[c]);
+
+            if(distance > moved)
+                moved = distance;
+        }
+
+        fillGrid(&grid);
+
+        if(moved <= tol)
+            break;
+    }
+
+    if(result && !assignObjectsToClusters(object_arr, object_arr_size, centroid_arr, required_clusters, &grid, &km, true, pool))
+    {
+        fprintf(stderr, "Error! Couldn't assign an object to the cluster\n");
+        result = false;
+    }
+
+    if(result && !fillClusters(object_arr, object_arr_size, cluster_arr, required_clusters, &km, NULL))
+    {
+        fprintf(stderr, "Error! Couldn't add an object to the cluster\n");
+        result = false;
+    }
+
+    destroyGrid(&grid);
+    destroyKMeans(&km);
+    scratchFree(centroid_arr);
+    scratchFree(cx);
+    scratchFree(cy);
+    scratchFree(seen);
+    scratchFree(batch_idx);
+    scratchFree(batch_label);
+    return result;
+}
+
+// finds the two nearest clusters in the part of the cluster array (rows of the pairs are interleaved between the threads,
+// so every thread compares about the same number of pairs)
+void findNeighboursTask(void *context, int thread, int threads)
+{
+    neighbours_task_t *t = (neighbours_task_t *) context;
+
+    t->min[thread] = MAX_CLUSTER_DISTANCE;
+    t->c1[thread] = t->c2[thread] = -1;
+
+    for(int row = thread; row < t->count - 1; row += threads)
+    {
+        int i = t->active[row];
+
+        for(int col = row + 1; col < t->count; col++)
+        {
+            int j = t->active[col];
+            float distance = t->get_distance(&t->carr[i], &t->carr[j]);
+
+            if(distance < t->min[thread])
+            {
+                t->min[thread] = distance;
+                t->c1[thread] = i;
+                t->c2[thread] = j;
+            }
+        }
+    }
+}
+
+// parallel version of find_neighbours, finds the same clusters (the first pair if there are more nearest pairs)
+// and saves their distance to 'distance'
+// 'active' contains the indexes of the clusters that are searched (in the order of the clusters)
+void findNeighboursParallel(cluster_t *carr, int *active, int count, int *c1, int *c2, float *distance, distanceFunction get_distance, pool_t *pool)
+{
+    assert(count > 0);
+
+    neighbours_task_t t = {.carr = carr, .active = active, .count = count, .get_distance = get_distance};
+    runParallel(pool, findNeighboursTask, &t);
+
+    float min = MAX_CLUSTER_DISTANCE;
+
+    for(int i = 0; i < pool->threads; i++)
+    {
+        if(t.c1[i] == -1)
+            continue;
+
+        if(t.min[i] < min || (t.min[i] == min && (t.c1[i] < *c1 || (t.c1[i] == *c1 && t.c2[i] < *c2))))
+        {
+            min = t.min[i];
+            *c1 = t.c1[i];
+            *c2 = t.c2[i];
+        }
+    }
+
+    *distance = min;
+}
+
+// implementation of single/complete/average linkage clustering algorithms
+// every merge is saved to 'merges' as the pair of the first objects of the merged clusters
+// clusters stay at their indexes until the end (the cluster at the index i has the object i as its first object)
+// and the merged clusters are only unlinked from the list of the active clusters in O(1), then the active clusters
+// are moved to the beginning of the array in their order
+// the list is copied to one array before every search, so the search reads the indexes one after another
+bool defaultClustering(int *arr_size, int required_clusters, cluster_t *cluster_arr, distanceFunction get_distance, edge_t *merges, pool_t *pool)
+{
+    int n = *arr_size, merge_cnt = 0;
+    int *next = (int *) scratchMalloc(sizeof(int) * n);  // next active cluster, -1 after the last one
+    int *prev = (int *) scratchMalloc(sizeof(int) * n);  // previous active cluster, -1 before the first one
+    int *active = (int *) scratchMalloc(sizeof(int) * n);  // active clusters in their order
+
+    if(next == NULL || prev == NULL || active == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for merging clusters\n");
+        scratchFree(next);
+        scratchFree(prev);
+        scratchFree(active);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        next[i] = i + 1 < n ? i + 1 : -1;
+        prev[i] = i - 1;
+    }
+
+    bool result = true;
+
+    while(n - merge_cnt != required_clusters)
+    {
+        int c1, c2; // indexes of the clusters in the cluster array
+        float distance;
+
+        int count = 0;
+
+        for(int i = 0; i != -1; i = next[i])
+            active[count++] = i;
+
+        // get the indexes of the clusters that have to be merged
+        findNeighboursParallel(cluster_arr, active, count, &c1, &c2, &distance, get_distance, pool);
+
+        // cluster with index c2 will be merged to the cluster with index c1
+        if(merge_clusters(&cluster_arr[c1], &cluster_arr[c2]) == NULL)
+        {
+            fprintf(stderr, "Error! Couldn't merge two clusters\n");
+            result = false;
+            break;
+        }
+
+        merges[merge_cnt++] = (edge_t) {.a = c1, .b = c2, .distance = distance};
+
+        // after merging remove cluster with index c2 (c1 < c2, so it is never the first cluster)
+        clear_cluster(&cluster_arr[c2]);
+        next[prev[c2]] = next[c2];
+
+        if(next[c2] != -1)
+            prev[next[c2]] = prev[c2];
+    }
+
+    // the first cluster is always active
+    *arr_size = 0;
+
+    for(int i = 0; i != -1; i = next[i])
+    {
+        cluster_t tmp = cluster_arr[*arr_size];
+
+        cluster_arr[*arr_size] = cluster_arr[i];
+        cluster_arr[i] = tmp;
+        (*arr_size)++;
+    }
+
+    scratchFree(next);
+    scratchFree(prev);
+    scratchFree(active);
+    return result;
+}
+
+// returns the index of the distance between the clusters i and j in the packed lower triangle of the distance matrix
+size_t matrixIndex(int i, int j)
+{
+    assert(i != j);
+
+    if(i > j)
+    {
+        int tmp = i;
+        i = j;
+        j = tmp;
+    }
+
+    return (size_t) j * (j - 1) / 2 + i;
+}
+
+// computes the rows of the distance matrix, rows are interleaved between the threads
+void distanceMatrixTask(void *context, int thread, int threads)
+{
+    matrix_task_t *t = (matrix_task_t *) context;
+
+    for(int j = thread + 1; j < t->m->size; j += threads)
+    {
+        float *row = t->m->dist + (size_t) j * (j - 1) / 2;
+
+        if(t->points == NULL)
+        {
+            for(int i = 0; i < j; i++)
+                row[i] = t->get_distance(&t->cluster_arr[i], &t->cluster_arr[j]);
+
+            continue;
+        }
+
+        squaredDistances(t->points, t->points->x[j], t->points->y[j], 0, j, row);
+        rootDistances(row, j);
+
+        // cluster_distance_average starts the sum with MIN_CLUSTER_DISTANCE
+        if(t->flag == 'a')
+            for(int i = 0; i < j; i++)
+                row[i] += MIN_CLUSTER_DISTANCE;
+    }
+}
+
+// computes the distance between every pair of the clusters from the cluster array
+bool initDistanceMatrix(distance_matrix_t *m, cluster_t *cluster_arr, int arr_size, distanceFunction get_distance, char flag, pool_t *pool)
+{
+    m->size = arr_size;
+
+    // + 1 in order to not call malloc with zero size when there is only one cluster
+    m->dist = (float *) scratchMalloc(sizeof(float) * ((size_t) arr_size * (arr_size - 1) / 2 + 1));
+
+    if(m->dist == NULL)
+        return false;
+
+    matrix_task_t t = {.m = m, .cluster_arr = cluster_arr, .get_distance = get_distance, .flag = flag};
+    points_t points;
+    bool single = true;  // all clusters have one object
+
+    for(int i = 0; i < arr_size && single; i++)
+        single = cluster_arr[i].size == 1;
+
+    // without the points the distances are computed by 'get_distance'
+    if(single && initPoints(&points, arr_size))
+    {
+        for(int i = 0; i < arr_size; i++)
+        {
+            points.x[i] = cluster_arr[i].obj[0].x;
+            points.y[i] = cluster_arr[i].obj[0].y;
+        }
+
+        t.points = &points;
+    }
+
+    runParallel(pool, distanceMatrixTask, &t);
+
+    if(t.points != NULL)
+        destroyPoints(&points);
+
+    return true;
+}
+
+// frees a memory that was allocated for the distance matrix
+void destroyDistanceMatrix(distance_matrix_t *m)
+{
+    scratchFree(m->dist);
+    m->dist = NULL;
+    m->size = 0;
+}
+
+// Lance-Williams formula
+// returns the distance between the cluster k and the cluster that was made by merging clusters i and j
+// d_ki, d_kj are distances before merging, ni, nj, nk are the sizes of the clusters
+float lanceWilliams(float d_ki, float d_kj, int ni, int nj, int nk, char flag)
+{
+    if(flag == 'c') // complete linkage
+        return d_ki > d_kj ? d_ki : d_kj;
+
+    // average linkage
+    // cluster_distance_average returns (sum - 1) / (ni * nk), where sum is the sum of the distances between objects,
+    // so the sum of the merged cluster is (d_ki * ni * nk + 1) + (d_kj * nj * nk + 1)
+    // computed in double, so the rounded result is never smaller than both d_ki and d_kj
+    return (float) (((double) d_ki * ni + (double) d_kj * nj + 1.0 / nk) / (ni + nj));
+}
+
+// pomocna funkce pro razeni hran minimalni kostry a spojeni shluku
+static int edge_sort_compar(const void *a, const void *b)
+{
+    const edge_t *e1 = (const edge_t *)a;
+    const edge_t *e2 = (const edge_t *)b;
+    if (e1->distance < e2->distance) return -1;
+    if (e1->distance > e2->distance) return 1;
+    if (e1->a != e2->a) return e1->a < e2->a ? -1 : 1;
+    if (e1->b != e2->b) return e1->b < e2->b ? -1 : 1;
+    return 0;
+}
+
+// returns the representative (index of the object) of the set that contains the object 'i'
+int findRoot(int *parent, int i)
+{
+    while(parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];  // path halving
+        i = parent[i];
+    }
+
+    return i;
+}
+
+// joins two sets represented by 'a' and 'b', the smaller index becomes the representative of the new set
+void joinRoots(int *parent, int a, int b)
+{
+    if(a < b)
+        parent[b] = a;
+    else
+        parent[a] = b;
+}
+
+// inserts a value to the binary min-heap that contains 'size' values
+void heapPush(int *heap, int size, int value)
+{
+    int i = size;
+
+    for(; i > 0 && heap[(i - 1) / 2] > value; i = (i - 1) / 2)
+        heap[i] = heap[(i - 1) / 2];
+
+    heap[i] = value;
+}
+
+// removes and returns the smallest value from the binary min-heap that contains 'size' values
+int heapPop(int *heap, int size)
+{
+    int min = heap[0];
+    int last = heap[--size];
+    int i = 0;
+
+    while(2 * i + 1 < size)
+    {
+        int child = 2 * i + 1;
+
+        if(child + 1 < size && heap[child + 1] < heap[child])
+            child++;
+
+        if(heap[child] >= last)
+            break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    heap[i] = last;
+    return min;
+}
+
+// makes the clusters from the object array after the objects were divided into the sets (every set will become a cluster)
+// clusters are ordered by the first object of the set (the same order as merging with remove_cluster gives)
+// and objects in the clusters are sorted by id
+// 'root' contains the representative of the set of every object and is used as a temporary array
+bool groupObjects(int *arr_size, obj_t *objects, int n, cluster_t *cluster_arr, int *root)
+{
+    int clusters = 0;
+
+    // sizes of the clusters are counted first, so every cluster is allocated only once
+    for(int i = 0; i < n; i++)
+    {
+        if(root[i] == i)
+        {
+            cluster_arr[clusters].size = 0;
+            root[i] = -(clusters++) - 1;  // mark the representative with the index of its cluster
+        }
+
+        cluster_arr[root[i] < 0 ? -root[i] - 1 : -root[root[i]] - 1].size++;
+    }
+
+    for(int i = 0; i < clusters; i++)
+    {
+        if(resize_cluster(&cluster_arr[i], cluster_arr[i].size) == NULL)
+        {
+            fprintf(stderr, "Error! Couldn't allocate memory for the cluster\n");
+            return false;
+        }
+
+        cluster_arr[i].size = 0;
+    }
+
+    for(int i = 0; i < n; i++)
+        append_cluster(&cluster_arr[root[i] < 0 ? -root[i] - 1 : -root[root[i]] - 1], objects[i]);
+
+    for(int i = 0; i < clusters; i++)
+        sort_cluster(&cluster_arr[i]);
+
+    *arr_size = clusters;
+    return true;
+}
+
+// merges clusters that are exactly 'distance' far from each other the same way as find_neighbours would do it:
+// the cluster with the smallest first object that has a neighbour absorbs its neighbour with the smallest first object
+// until it has no neighbours or 'merges' clusters were merged
+bool mergeTiedClusters(obj_t *objects, int n, int *parent, float distance, int merges)
+{
+    int *component = (int *) scratchMalloc(sizeof(int) * n);  // set of every object before merging
+    int *head = (int *) scratchMalloc(sizeof(int) * n);  // first object of the set
+    int *next = (int *) scratchMalloc(sizeof(int) * n);  // next object of the same set
+    int *heap = (int *) scratchMalloc(sizeof(int) * n);  // neighbours of the absorbing cluster
+    int *found = (int *) scratchMalloc(sizeof(int) * n);  // objects found in the grid
+    bool *queued = (bool *) scratchMalloc(sizeof(bool) * n);  // set was already absorbed or is in the heap
+    grid_t grid;
+
+    if(component == NULL || head == NULL || next == NULL || heap == NULL || found == NULL || queued == NULL ||
+       !initGrid(&grid, objects, n))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for merging clusters\n");
+        scratchFree(component);
+        scratchFree(head);
+        scratchFree(next);
+        scratchFree(heap);
+        scratchFree(found);
+        scratchFree(queued);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        component[i] = findRoot(parent, i);
+        head[i] = -1;
+        queued[i] = false;
+    }
+
+    for(int i = n - 1; i >= 0; i--)
+    {
+        next[i] = head[component[i]];
+        head[component[i]] = i;
+    }
+
+    for(int u = 0; u < n && merges > 0; u++)
+    {
+        if(component[u] != u || queued[u])
+            continue;
+
+        queued[u] = true;
+
+        int heap_size = 0;
+        int set = u;
+
+        while(true)
+        {
+            // add clusters that are 'distance' far from the absorbed cluster to the heap
+            for(int i = head[set]; i != -1; i = next[i])
+            {
+                int found_cnt = gridRadius(&grid, &objects[i], distance, found);
+
+                for(int k = 0; k < found_cnt; k++)
+                {
+                    int j = found[k];
+
+                    if(queued[component[j]])
+                        continue;
+
+                    countDistances(1);
+
+                    if(obj_distance(&objects[i], &objects[j]) == distance)
+                    {
+                        queued[component[j]] = true;
+                        heapPush(heap, heap_size++, component[j]);
+                    }
+                }
+            }
+
+            if(heap_size == 0 || merges == 0)
+                break;
+
+            set = heapPop(heap, heap_size--);
+            joinRoots(parent, u, set);
+            merges--;
+        }
+    }
+
+    destroyGrid(&grid);
+    scratchFree(component);
+    scratchFree(head);
+    scratchFree(next);
+    scratchFree(heap);
+    scratchFree(found);
+    scratchFree(queued);
+    return true;
+}
+
+// updates the distances to the tree after the object 'last' was added to the tree and finds the closest object
+// in the part of the objects (every thread gets one continuous part)
+void updateTreeTask(void *context, int thread, int threads)
+{
+    tree_task_t *t = (tree_task_t *) context;
+
+    int from = (int) ((long long) t->size * thread / threads), to = (int) ((long long) t->size * (thread + 1) / threads);
+    int closest = -1;
+
+    // objects in the tree have negative distances, so they are never updated
+    relaxDistances(t->points, t->last, from, to, t->tree_dist, t->nearest);
+
+    for(int j = from; j < to; j++)
+    {
+        if(t->tree_dist[j] < 0)
+            continue;
+
+        if(closest == -1 || t->tree_dist[j] < t->tree_dist[closest])
+            closest = j;
+    }
+
+    t->closest[thread] = closest;
+}
+
+// finds the minimum spanning tree of the objects (Prim's algorithm) and saves its n - 1 edges to 'edges'
+// edges are sorted by their lengths and by the objects, so single linkage merges the objects in this order
+// (only the order of the edges that are equally long can differ, see mergeTiedClusters)
+bool minimumSpanningTree(obj_t *objects, int n, edge_t *edges, pool_t *pool)
+{
+    float *tree_dist = (float *) scratchMalloc(sizeof(float) * n);  // distance to the tree, negative if object is in the tree
+    int *nearest = (int *) scratchMalloc(sizeof(int) * n);  // nearest object in the tree
+    points_t points = {0};
+
+    if(tree_dist == NULL || nearest == NULL || !initPoints(&points, n))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the minimum spanning tree\n");
+        scratchFree(tree_dist);
+        scratchFree(nearest);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        points.x[i] = objects[i].x;
+        points.y[i] = objects[i].y;
+        tree_dist[i] = INFINITY;
+    }
+
+    // Prim's algorithm, starts with the first object
+    tree_task_t t = {.points = &points, .size = n, .last = 0, .tree_dist = tree_dist, .nearest = nearest};
+    tree_dist[0] = MIN_CLUSTER_DISTANCE;
+
+    for(int i = 0; i < n - 1; i++)
+    {
+        runParallel(pool, updateTreeTask, &t);
+
+        // the first closest object, parts of the threads are ordered
+        int closest = -1;
+
+        for(int j = 0; j < pool->threads; j++)
+            if(t.closest[j] != -1 && (closest == -1 || tree_dist[t.closest[j]] < tree_dist[closest]))
+                closest = t.closest[j];
+
+        edges[i] = (edge_t) {.a = nearest[closest], .b = closest, .distance = sqrt(tree_dist[closest])};
+        tree_dist[closest] = MIN_CLUSTER_DISTANCE;
+        t.last = closest;
+    }
+
+    scratchFree(tree_dist);
+    scratchFree(nearest);
+    destroyPoints(&points);
+
+    if(n > 1)
+        qsort(edges, n - 1, sizeof(edge_t), &edge_sort_compar);
+
+    return true;
+}
+
+// frees a memory that was allocated for the lists of the objects
+void destroyMembers(members_t *mb)
+{
+    scratchFree(mb->head);
+    scratchFree(mb->next);
+    scratchFree(mb->first);
+    scratchFree(mb->second);
+    scratchFree(mb->cached);
+    *mb = (members_t) {0};
+}
+
+// allocates the lists of the objects of 'n' rows, every row starts with its own object
+bool initMembers(members_t *mb, int n)
+{
+    mb->head = (int *) scratchMalloc(sizeof(int) * n);
+    mb->next = (int *) scratchMalloc(sizeof(int) * n);
+    mb->first = (obj_t *) scratchMalloc(sizeof(obj_t) * n);
+    mb->second = (obj_t *) scratchMalloc(sizeof(obj_t) * n);
+    mb->cached = (float *) scratchMalloc(sizeof(float) * n);
+
+    if(mb->head == NULL || mb->next == NULL || mb->first == NULL || mb->second == NULL || mb->cached == NULL)
+    {
+        destroyMembers(mb);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        mb->head[i] = i;
+        mb->next[i] = -1;
+    }
+
+    return true;
+}
+
+// moves the objects of the row 'b' to the row 'a', the objects stay sorted by the ids
+void mergeMembers(members_t *mb, cluster_t *cluster_arr, int a, int b)
+{
+    int *last = &mb->head[a];  // link that gets the next object
+    int i = mb->head[a], j = mb->head[b];
+
+    while(i != -1 && j != -1)
+    {
+        int *smaller = cluster_arr[i].obj[0].id < cluster_arr[j].obj[0].id ? &i : &j;
+
+        *last = *smaller;
+        last = &mb->next[*smaller];
+        *smaller = mb->next[*smaller];
+    }
+
+    *last = i != -1 ? i : j;
+    mb->head[b] = -1;
+}
+
+// computes the distance between the clusters of the rows i < j by 'get_distance' from their objects,
+// so the distance is rounded the same way as the distance that find_neighbours computes for the clusters
+float exactDistance(members_t *mb, cluster_t *cluster_arr, int i, int j, distanceFunction get_distance)
+{
+    cluster_t c1 = {.obj = mb->first}, c2 = {.obj = mb->second};
+
+    for(int k = mb->head[i]; k != -1; k = mb->next[k])
+        c1.obj[c1.size++] = cluster_arr[k].obj[0];
+
+    for(int k = mb->head[j]; k != -1; k = mb->next[k])
+        c2.obj[c2.size++] = cluster_arr[k].obj[0];
+
+    c1.capacity = c1.size;
+    c2.capacity = c2.size;
+    return get_distance(&c1, &c2);
+}
+
+// returns the tolerance of the rounding of the cached average linkage distance
+float averageTolerance(float distance)
+{
+    return (fabsf(distance) + 1.0f) * AVERAGE_EPSILON;
+}
+
+// finds the nearest row of the row 'a' again among the rows whose cached distances are at most the tolerance
+// from the minimum 'min', their distances are computed exactly and the smallest row is taken if they are equal
+// (as find_neighbours takes the first pair), returns the nearest row and saves its exact distance to 'distance'
+int exactNearest(members_t *mb, distance_matrix_t *m, cluster_t *cluster_arr, int *size, int first, int a, float min,
+                 distanceFunction get_distance, float *distance)
+{
+    int nearest = -1;
+
+    for(int k = first; k < m->size; k++)
+    {
+        if(k == a || size[k] == 0 || m->dist[matrixIndex(a, k)] > min + averageTolerance(min))
+            continue;
+
+        float exact = a < k ? exactDistance(mb, cluster_arr, a, k, get_distance) :
+                              exactDistance(mb, cluster_arr, k, a, get_distance);
+
+        if(nearest == -1 || exact < *distance)
+        {
+            *distance = exact;
+            nearest = k;
+        }
+    }
+
+    return nearest;
+}
+
+// finds all n - 1 merges of complete/average linkage with the cached distance matrix
+// and the nearest-neighbour chain: the chain is extended with the nearest cluster of its last cluster until
+// the last two clusters are nearest to each other, then they are merged
+// both linkages never make the distance to the merged cluster smaller, so the merges are the same as the merges
+// that find_neighbours would find, only found in a different order, they are sorted to the order of find_neighbours
+// if two distances are equal, the pair with the smaller first objects is treated as closer (as find_neighbours does)
+// average linkage updates the cached distances by the Lance-Williams formula, which rounds them differently than
+// cluster_distance_average, so the distances that are nearly equal and the distances of the merges are computed
+// again from the objects of the clusters (every object starts in its own cluster)
+// returns false if there is not enough memory for the matrix
+bool matrixMerges(cluster_t *cluster_arr, int n, distanceFunction get_distance, char flag, edge_t *merges, pool_t *pool)
+{
+    distance_matrix_t m;
+    members_t mb = {0};
+
+    int *size = (int *) scratchMalloc(sizeof(int) * n);  // size of the cluster in the row, 0 if the row was merged
+    int *chain = (int *) scratchMalloc(sizeof(int) * n);  // nearest-neighbour chain
+
+    if(size == NULL || chain == NULL || (flag == 'a' && !initMembers(&mb, n)) ||
+       !initDistanceMatrix(&m, cluster_arr, n, get_distance, flag, pool))
+    {
+        scratchFree(size);
+        scratchFree(chain);
+        destroyMembers(&mb);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+        size[i] = cluster_arr[i].size;
+
+    int chain_size = 0, merge_cnt = 0, first = 0;  // first row that wasn't merged
+
+    while(merge_cnt < n - 1)
+    {
+        if(chain_size == 0)
+        {
+            while(size[first] == 0)
+                first++;
+
+            chain[chain_size++] = first;
+        }
+
+        int a = chain[chain_size - 1], b = -1;
+        float min = MAX_CLUSTER_DISTANCE;
+        int near = 0;  // number of the distances that may be equal to the minimum after the rounding (average linkage)
+
+        for(int k = first; k < n; k++)
+        {
+            if(k == a || size[k] == 0)
+                continue;
+
+            float distance = m.dist[matrixIndex(a, k)];
+
+            if(distance < min)
+            {
+                near = distance >= min - averageTolerance(min) ? near + 1 : 1;
+                min = distance;
+                b = k;
+            }
+            else if(distance <= min + averageTolerance(min))
+                near++;
+        }
+
+        if(flag == 'a' && near > 1)
+            b = exactNearest(&mb, &m, cluster_arr, size, first, a, min, get_distance, &min);
+
+        if(chain_size < 2 || chain[chain_size - 2] != b)
+        {
+            chain[chain_size++] = b;
+            continue;
+        }
+
+        chain_size -= 2;
+
+        if(b < a)
+        {
+            int tmp = a;
+            a = b;
+            b = tmp;
+        }
+
+        // the row of the first object stays
+        if(flag == 'a')
+        {
+            mb.cached[b] = m.dist[matrixIndex(a, b)];
+            min = exactDistance(&mb, cluster_arr, a, b, get_distance);
+            mergeMembers(&mb, cluster_arr, a, b);
+        }
+
+        merges[merge_cnt++] = (edge_t) {.a = a, .b = b, .distance = min};
+
+        // the row 'a' becomes the row of the merged cluster
+        for(int k = first; k < n; k++)
+        {
+            if(k == a || k == b || size[k] == 0)
+                continue;
+
+            size_t ka = matrixIndex(k, a);
+            m.dist[ka] = lanceWilliams(m.dist[ka], m.dist[matrixIndex(k, b)], size[a], size[b], size[k], flag);
+        }
+
+        size[a] += size[b];
+        size[b] = 0;
+    }
+
+    destroyDistanceMatrix(&m);
+    scratchFree(chain);
+    scratchFree(size);
+
+    qsort(merges, merge_cnt, sizeof(edge_t), &edge_sort_compar);
+
+    // average linkage merges are sorted by the exact distances, the linkage matrix gets the cached distances,
+    // they are computed in double, so they are rounded less for big clusters (every row is merged once)
+    for(int i = 0; i < merge_cnt && flag == 'a'; i++)
+        merges[i].distance = mb.cached[merges[i].b];
+
+    destroyMembers(&mb);
+    return true;
+}
+
+// squared distance of two clusters of Ward ('w') or centroid ('m') linkage, it doesn't depend on the size of the clusters
+// centroid linkage: squared distance of the centroids of the clusters
+// Ward: squared distance of the centroids * 2 * ni * nj / (ni + nj), it is twice the increase of the sum of the
+//       squared distances of the objects to their centroid after the merge (objects are as far as in the other linkages)
+double momentDistance(moments_t *m1, moments_t *m2, char flag)
+{
+    double dx = m1->x - m2->x, dy = m1->y - m2->y;
+    double distance = dx * dx + dy * dy;
+
+    if(flag == 'w')
+        distance *= 2.0 * m1->count * m2->count / (m1->count + m2->count);
+
+    return distance;
+}
+
+// finds the nearest cluster of the cluster at the position 'p' of the active clusters among the clusters after it
+// if there are more nearest clusters, the first of them is taken
+void findNearestAfter(nearest_task_t *t, int p)
+{
+    int i = t->active[p];
+
+    t->nearest[i] = -1;
+    t->nearest_dist[i] = INFINITY;
+
+    countDistances(t->size - p - 1);
+
+    for(int q = p + 1; q < t->size; q++)
+    {
+        int j = t->active[q];
+
+        if(t->moments[j].count == 0)
+            continue;
+
+        double distance = momentDistance(&t->moments[i], &t->moments[j], t->flag);
+
+        if(distance < t->nearest_dist[i])
+        {
+            t->nearest_dist[i] = distance;
+            t->nearest[i] = j;
+        }
+    }
+}
+
+// updates the nearest clusters of the part of the clusters after the last merge (all of them are found before
+// the first merge) and finds the cluster with the nearest other cluster among them
+// rows are interleaved, so the threads get about the same work
+void nearestTask(void *context, int thread, int threads)
+{
+    nearest_task_t *t = (nearest_task_t *) context;
+    int a = t->a, b = t->b, best = -1;
+    unsigned long long compared = 0;
+
+    for(int p = thread; p < t->size; p += threads)
+    {
+        int i = t->active[p];
+
+        if(t->moments[i].count == 0)
+            continue;
+
+        // the distance to the nearest cluster changed or the cluster doesn't exist anymore
+        if(a == -1 || i == a || t->nearest[i] == a || t->nearest[i] == b)
+            findNearestAfter(t, p);
+        else if(i < a)
+        {
+            // the merged cluster can be nearer than the nearest cluster of the clusters before it
+            double distance = momentDistance(&t->moments[i], &t->moments[a], t->flag);
+            compared++;
+
+            if(distance < t->nearest_dist[i] || (distance == t->nearest_dist[i] && a < t->nearest[i]))
+            {
+                t->nearest_dist[i] = distance;
+                t->nearest[i] = a;
+            }
+        }
+
+        // the rows are searched in their order, so the first of the equally near clusters stays
+        if(t->nearest[i] != -1 && (best == -1 || t->nearest_dist[i] < t->nearest_dist[best]))
+            best = i;
+    }
+
+    countDistances(compared);
+    t->best[thread] = best;
+}
+
+// finds the merges of Ward/centroid linkage until 'stop' clusters remain
+// every cluster keeps its nearest cluster with a greater index, so the two nearest clusters are found in one pass,
+// after a merge only the clusters whose nearest cluster was merged are searched again (centroid linkage can make
+// the distance to the merged cluster smaller, so the nearest-neighbour chain can't be used)
+// the threads update the clusters after every merge, their best clusters are compared in the order of the threads,
+// so the merges don't depend on the number of the threads
+// if two distances are equal, the pair with the smaller first cluster is merged (as find_neighbours does),
+// the merged cluster stays at the index of the first cluster, merges are in the order they were found
+// 'weight' is the number of the objects every object stands for, NULL if only for itself
+bool momentMerges(obj_t *objects, int *weight, int n, int stop, char flag, edge_t *merges, pool_t *pool)
+{
+    nearest_task_t t = {.size = n, .flag = flag, .a = -1, .b = -1};
+
+    t.moments = (moments_t *) scratchMalloc(sizeof(moments_t) * n);
+    t.active = (int *) scratchMalloc(sizeof(int) * n);
+    t.nearest = (int *) scratchMalloc(sizeof(int) * n);
+    t.nearest_dist = (double *) scratchMalloc(sizeof(double) * n);
+
+    if(t.moments == NULL || t.active == NULL || t.nearest == NULL || t.nearest_dist == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for merging clusters\n");
+        scratchFree(t.moments);
+        scratchFree(t.active);
+        scratchFree(t.nearest);
+        scratchFree(t.nearest_dist);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        int count = weight != NULL ? weight[i] : 1;
+
+        t.moments[i] = (moments_t) {.count = count, .sum_x = (long long) objects[i].x * count,
+                                    .sum_y = (long long) objects[i].y * count, .x = objects[i].x, .y = objects[i].y};
+        t.active[i] = i;
+    }
+
+    for(int merge_cnt = 0; merge_cnt < n - stop; merge_cnt++)
+    {
+        runParallel(pool, nearestTask, &t);
+
+        int a = -1;
+
+        for(int i = 0; i < pool->threads; i++)
+        {
+            int best = t.best[i];
+
+            if(best != -1 && (a == -1 || t.nearest_dist[best] < t.nearest_dist[a] ||
+                              (t.nearest_dist[best] == t.nearest_dist[a] && best < a)))
+                a = best;
+        }
+
+        int b = t.nearest[a];
+
+        merges[merge_cnt] = (edge_t) {.a = a, .b = b, .distance = sqrt(t.nearest_dist[a])};
+
+        moments_t *m = &t.moments[a];
+
+        m->count += t.moments[b].count;
+        m->sum_x += t.moments[b].sum_x;
+        m->sum_y += t.moments[b].sum_y;
+        m->x = (double) m->sum_x / m->count;
+        m->y = (double) m->sum_y / m->count;
+        t.moments[b].count = 0;
+
+        t.a = a;
+        t.b = b;
+
+        // merged clusters are removed when they are a quarter of the active clusters, so the searches skip only a few
+        if(4 * (merge_cnt + 1 - (n - t.size)) >= t.size)
+        {
+            int size = 0;
+
+            for(int p = 0; p < t.size; p++)
+                if(t.moments[t.active[p]].count > 0)
+                    t.active[size++] = t.active[p];
+
+            t.size = size;
+        }
+    }
+
+    scratchFree(t.moments);
+    scratchFree(t.active);
+    scratchFree(t.nearest);
+    scratchFree(t.nearest_dist);
+    return true;
+}
+
+void destroyHierarchy(hierarchy_t *h)
+{
+    scratchFree(h->merges);
+    *h = (hierarchy_t) {0};
+}
+
+// expands the hierarchy of the groups of the objects with the same coordinates to the hierarchy of all 'n' objects:
+// every object is merged to the first object of its group at the distance 0, then the groups are merged
+// (single, complete, Ward and centroid linkage merge the objects with the same coordinates before any other objects,
+// the distances between the groups are the same as the distances between their objects)
+bool expandHierarchy(hierarchy_t *h, duplicates_t *d, obj_t *objects, int n)
+{
+    edge_t *merges = (edge_t *) scratchMalloc(sizeof(edge_t) * n);
+
+    if(merges == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the merges\n");
+        destroyHierarchy(h);
+        return false;
+    }
+
+    int merge_cnt = 0;
+
+    for(int i = 0; i < n; i++)
+        if(d->first[d->group[i]] != i)
+            merges[merge_cnt++] = (edge_t) {.a = d->first[d->group[i]], .b = i, .distance = 0.0};
+
+    // groups are in the order of their first objects, so the order of the merges of the same length stays the same
+    for(int i = 0; i < h->merge_count; i++)
+        merges[merge_cnt++] = (edge_t) {.a = d->first[h->merges[i].a], .b = d->first[h->merges[i].b],
+                                        .distance = h->merges[i].distance};
+
+    scratchFree(h->merges);
+    *h = (hierarchy_t) {.objects = objects, .size = n, .merges = merges, .merge_count = merge_cnt, .tree = h->tree,
+                        .average = h->average};
+    return true;
+}
+
+// finds the merges of the hierarchical clustering of the objects until 'stop' clusters remain
+// the minimum spanning tree and the distance matrix always find all merges, only the slow search
+// (when there is not enough memory for the matrix) stops earlier
+// 'weight' is the number of the objects every object stands for (only Ward/centroid linkage depends on it)
+bool buildHierarchy(hierarchy_t *h, cluster_context_t *ctx, obj_t *objects, int *weight, int n, int stop, char flag)
+{
+    *h = (hierarchy_t) {.objects = objects, .size = n, .merge_count = n - 1, .tree = flag == 's', .average = flag == 'a'};
+    h->merges = (edge_t *) scratchMalloc(sizeof(edge_t) * n);
+
+    // every object starts in its own cluster (complete/average linkage)
+    bool matrix = flag == 'c' || flag == 'a';
+    cluster_t *clusters = matrix ? (cluster_t *) scratchMalloc(sizeof(cluster_t) * n) : NULL;
+
+    if(h->merges == NULL || (matrix && clusters == NULL))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the merges\n");
+        destroyHierarchy(h);
+        return false;
+    }
+
+    // Ward/centroid linkage needs only the sums of the clusters, so they never need the distance matrix
+    if(flag == 'w' || flag == 'm')
+    {
+        if(!momentMerges(h->objects, weight, n, stop, flag, h->merges, &ctx->pool))
+        {
+            destroyHierarchy(h);
+            return false;
+        }
+
+        h->merge_count = n - stop;
+        return true;
+    }
+
+    if(flag == 's')
+    {
+        if(!minimumSpanningTree(h->objects, n, h->merges, &ctx->pool))
+        {
+            destroyHierarchy(h);
+            return false;
+        }
+
+        return true;
+    }
+
+    // the distance matrix only reads the clusters, so they use the objects from the object array
+    distanceFunction get_distance = flag == 'c' ? cluster_distance_complete : cluster_distance_average;
+
+    for(int i = 0; i < n; i++)
+        clusters[i] = (cluster_t) {.size = 1, .capacity = 1, .obj = &h->objects[i]};
+
+    if(matrixMerges(clusters, n, get_distance, flag, h->merges, &ctx->pool))
+    {
+        scratchFree(clusters);
+        return true;
+    }
+
+    // the slow search merges the clusters, so they need their own memory
+    // the merges are found in their order, so they are not sorted
+    int arr_size = n;
+    bool result = true;
+
+    for(int i = 0; i < n; i++)
+        init_cluster(&clusters[i], 0);
+
+    for(int i = 0; i < n && result; i++)
+        result = append_cluster(&clusters[i], h->objects[i]) != NULL;
+
+    if(!result)
+        fprintf(stderr, "Error! Couldn't allocate memory for the clusters\n");
+
+    result = result && defaultClustering(&arr_size, stop, clusters, get_distance, h->merges, &ctx->pool);
+
+    for(int i = 0; i < n; i++)
+        clear_cluster(&clusters[i]);
+
+    scratchFree(clusters);
+
+    if(!result)
+    {
+        destroyHierarchy(h);
+        return false;
+    }
+
+    h->merge_count = n - stop;
+    return true;
+}
+
+// makes 'required_clusters' clusters from the first merges of the hierarchy in the clusters of the context
+// (the same clusters as merging until 'required_clusters' clusters remain would make)
+bool partitionHierarchy(hierarchy_t *h, int required_clusters, cluster_context_t *ctx, int *arr_size)
+{
+    int n = h->size, merges = n - required_clusters;
+    int *parent = (int *) scratchMalloc(sizeof(int) * n);  // sets of the objects
+
+    if(parent == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for merging clusters\n");
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+        parent[i] = i;
+
+    bool result = true;
+
+    if(h->tree && merges > 0)
+    {
+        // all edges shorter than the last merged edge are merged regardless of the order of the merges
+        float cut = h->merges[merges - 1].distance;
+        int i;
+
+        for(i = 0; h->merges[i].distance < cut; i++)
+            joinRoots(parent, findRoot(parent, h->merges[i].a), findRoot(parent, h->merges[i].b));
+
+        // which clusters are merged with the edges that are as long as the last merged edge depends on the order
+        result = mergeTiedClusters(h->objects, n, parent, cut, merges - i);
+    }
+    else
+    {
+        for(int i = 0; i < merges; i++)
+            joinRoots(parent, findRoot(parent, h->merges[i].a), findRoot(parent, h->merges[i].b));
+    }
+
+    for(int i = 0; i < n && result; i++)
+        parent[i] = findRoot(parent, i);
+
+    result = result && groupObjects(arr_size, h->objects, n, ctx->clusters, parent);
+
+    for(int i = *arr_size; i < ctx->cluster_capacity && result; i++)
+        clear_cluster(&ctx->clusters[i]);
+
+    scratchFree(parent);
+    return result;
+}
+
+// writes the merges of the hierarchy to the file as the linkage matrix (the format of scipy.cluster.hierarchy):
+// one line 'C1 C2 DISTANCE SIZE' for every merge, objects are the clusters 0 to n - 1 (indexes in the input file)
+// and the cluster made by the merge on the line i (from 0) is the cluster n + i
+bool writeLinkage(hierarchy_t *h, char *filename)
+{
+    int n = h->size;
+    int *parent = (int *) scratchMalloc(sizeof(int) * n);  // sets of the objects
+    int *label = (int *) scratchMalloc(sizeof(int) * n);  // cluster of the set in the linkage matrix
+    int *size = (int *) scratchMalloc(sizeof(int) * n);  // size of the set
+
+    if(parent == NULL || label == NULL || size == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the linkage matrix\n");
+        scratchFree(parent);
+        scratchFree(label);
+        scratchFree(size);
+        return false;
+    }
+
+    FILE *file = fopen(filename, "w");
+
+    if(file == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't open the file '%s'\n", filename);
+        scratchFree(parent);
+        scratchFree(label);
+        scratchFree(size);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        parent[i] = label[i] = i;
+        size[i] = 1;
+    }
+
+    for(int i = 0; i < h->merge_count; i++)
+    {
+        int a = findRoot(parent, h->merges[i].a), b = findRoot(parent, h->merges[i].b);
+        int c1 = label[a] < label[b] ? label[a] : label[b], c2 = label[a] < label[b] ? label[b] : label[a];
+        int merged = size[a] + size[b];
+        float distance = h->merges[i].distance;
+
+        // the merges of average linkage are ordered by the distances with - 1 in the sum, the file gets the real averages
+        if(h->average)
+            distance = (float) (distance + 1.0 / ((double) size[a] * size[b]));
+
+        fprintf(file, "%d %d %.9g %d\n", c1, c2, distance, merged);
+
+        // the smaller index becomes the representative
+        joinRoots(parent, a, b);
+        a = a < b ? a : b;
+        label[a] = n + i;
+        size[a] = merged;
+    }
+
+    bool result = !ferror(file);
+
+    if(fclose(file) != 0 || !result)
+    {
+        fprintf(stderr, "Error! Couldn't write to the file '%s'\n", filename);
+        result = false;
+    }
+
+    scratchFree(parent);
+    scratchFree(label);
+    scratchFree(size);
+    return result;
+}
+
+// returns the name of the file 'filename' followed by 'suffix' (NULL if there is not enough memory)
+char *suffixedName(char *filename, char *suffix)
+{
+    char *name = (char *) countedMalloc(strlen(filename) + strlen(suffix) + 1);
+
+    if(name == NULL)
+        fprintf(stderr, "Error! Couldn't allocate memory for the name of the file\n");
+    else
+        sprintf(name, "%s%s", filename, suffix);
+
+    return name;
+}
+
+// reads 'size' bytes at the offset of the file
+bool readAt(FILE *f, uint64_t offset, void *data, size_t size)
+{
+    return fseeko(f, (off_t) offset, SEEK_SET) == 0 && fread(data, 1, size, f) == size;
+}
+
+// writes 'size' bytes at the offset of the file
+bool writeAt(FILE *f, uint64_t offset, const void *data, size_t size)
+{
+    return fseeko(f, (off_t) offset, SEEK_SET) == 0 && fwrite(data, 1, size, f) == size;
+}
+
+// returns the number of the slots of the saved hash table of 'count' ids
+// the table is at most a quarter full when it is made, so it is made again only after the number of the ids doubled
+uint64_t stateSlots(uint64_t count)
+{
+    uint64_t slots = 4;
+
+    while(slots < 4 * count)
+        slots *= 2;
+
+    return slots;
+}
+
+// adds the id to the saved hash table with 'mask' + 1 slots, returns false if the id is already in the table
+bool putId(int32_t *table, size_t mask, int id)
+{
+    size_t slot = idSlot(id, mask);
+
+    while(table[slot] != 0)
+    {
+        if(table[slot] == id)
+            return false;
+
+        slot = (slot + 1) & mask;
+    }
+
+    table[slot] = id;
+    return true;
+}
+
+static int extra_sort_compar(const void *a, const void *b)
+{
+    const state_extra_t *e1 = (const state_extra_t *) a;
+    const state_extra_t *e2 = (const state_extra_t *) b;
+
+    if(e1->position != e2->position)
+        return e1->position < e2->position ? -1 : 1;
+
+    return (e1->label > e2->label) - (e1->label < e2->label);
+}
+
+static int int_sort_compar(const void *a, const void *b)
+{
+    int i1 = *(const int *) a, i2 = *(const int *) b;
+    return (i1 > i2) - (i1 < i2);
+}
+
+// saves the final clusters of k-means or single linkage to the state file, the old file is replaced only after
+// the whole state was written
+// 'distance' is the longest distance merged by single linkage (negative if no objects were merged)
+bool saveState(char *filename, cluster_t *clusters, int count, char flag, float distance)
+{
+    int size = 0;
+
+    for(int i = 0; i < count; i++)
+        size += clusters[i].size;
+
+    state_header_t header = {.magic = STATE_MAGIC, .version = STATE_VERSION, .flag = (uint32_t) flag,
+                             .clusters = (uint32_t) count, .objects = (uint64_t) size, .id_slots = stateSlots(size),
+                             .parent_capacity = flag == 's' ? 2 * (uint64_t) count : 0, .distance = distance};
+
+    size_t section = flag == 'k' ? sizeof(state_cluster_t) * count : sizeof(int32_t) * STATE_SIDE * STATE_SIDE;
+
+    header.id_offset = sizeof(state_header_t) + section;
+    header.parent_offset = header.id_offset + sizeof(int32_t) * header.id_slots;
+    header.extra_offset = header.parent_offset + sizeof(int32_t) * header.parent_capacity;
+
+    void *first = countedCalloc(1, section);  // sums of the clusters or the table of the positions
+    int32_t *ids = (int32_t *) countedCalloc(header.id_slots, sizeof(int32_t));
+    int32_t *parents = (int32_t *) countedMalloc(sizeof(int32_t) * (header.parent_capacity + 1));
+    state_extra_t *extra = (state_extra_t *) countedMalloc(sizeof(state_extra_t) * (flag == 's' ? size : 1));
+    char *tmp_name = suffixedName(filename, ".tmp"), *journal_name = suffixedName(filename, ".journal");
+
+    bool result = first != NULL && ids != NULL && parents != NULL && extra != NULL;
+
+    if(!result)
+        fprintf(stderr, "Error! Couldn't allocate memory for the state of the clustering\n");
+
+    state_cluster_t *sums = (state_cluster_t *) first;
+    int32_t *positions = (int32_t *) first;
+
+    for(int i = 0; i < STATE_SIDE * STATE_SIDE && result && flag == 's'; i++)
+        positions[i] = -1;
+
+    for(int i = 0; i < count && result; i++)
+    {
+        for(int j = 0; j < clusters[i].size; j++)
+        {
+            obj_t *obj = &clusters[i].obj[j];
+            int position = (int) obj->y * STATE_SIDE + (int) obj->x;
+
+            putId(ids, header.id_slots - 1, obj->id);
+
+            if(flag == 'k')
+            {
+                sums[i].sum_x += (int64_t) obj->x;
+                sums[i].sum_y += (int64_t) obj->y;
+                sums[i].count++;
+            }
+            else if(positions[position] == -1)
+                positions[position] = i;
+            else if(positions[position] != i && distance >= 0)  // objects at distance 0 weren't all merged
+                extra[header.extra_count++] = (state_extra_t) {.position = position, .label = i};
+        }
+    }
+
+    // the other labels are searched by the positions, every label of the position is saved once
+    if(header.extra_count > 0)
+    {
+        qsort(extra, header.extra_count, sizeof(state_extra_t), &extra_sort_compar);
+
+        uint64_t unique = 1;
+
+        for(uint64_t i = 1; i < header.extra_count; i++)
+            if(extra[i].position != extra[unique - 1].position || extra[i].label != extra[unique - 1].label)
+                extra[unique++] = extra[i];
+
+        header.extra_count = unique;
+    }
+
+    for(uint64_t i = 0; i < header.parent_capacity && result; i++)
+        parents[i] = (int32_t) i;
+
+    FILE *f = result && tmp_name != NULL && journal_name != NULL ? fopen(tmp_name, "wb") : NULL;
+
+    if(result && tmp_name != NULL && journal_name != NULL && f == NULL)
+        fprintf(stderr, "Error! Couldn't open the file '%s'\n", tmp_name);
+
+    if(f != NULL)
+    {
+        result = fwrite(&header, sizeof(state_header_t), 1, f) == 1 && fwrite(first, 1, section, f) == section &&
+                 fwrite(ids, sizeof(int32_t), header.id_slots, f) == header.id_slots &&
+                 fwrite(parents, sizeof(int32_t), header.parent_capacity, f) == header.parent_capacity &&
+                 fwrite(extra, sizeof(state_extra_t), header.extra_count, f) == header.extra_count;
+
+        // a journal of the previous state must not be applied to the new one
+        if(fclose(f) != 0 || !result || (remove(journal_name) != 0 && errno != ENOENT) || rename(tmp_name, filename) != 0)
+        {
+            fprintf(stderr, "Error! Couldn't write to the file '%s'\n", filename);
+            remove(tmp_name);
+            result = false;
+        }
+    }
+
+    free(first);
+    free(ids);
+    free(parents);
+    free(extra);
+    free(tmp_name);
+    free(journal_name);
+    return result && f != NULL;
+}
+
+// adds a write of 'size' bytes at the offset of the state file to the journal
+bool journalWrite(journal_t *j, uint64_t offset, const void *data, size_t size)
+{
+    uint64_t record[2] = {offset, size};
+    size_t needed = j->size + sizeof(record) + size;
+
+    if(needed > j->capacity)
+    {
+        size_t capacity = j->capacity > 0 ? j->capacity : 4096;
+
+        while(capacity < needed)
+            capacity *= 2;
+
+        unsigned char *arr = (unsigned char *) countedRealloc(j->data, capacity);
+
+        if(arr == NULL)
+        {
+            fprintf(stderr, "Error! Couldn't allocate memory for the journal of the state\n");
+            return false;
+        }
+
+        j->data = arr;
+        j->capacity = capacity;
+    }
+
+    memcpy(j->data + j->size, record, sizeof(record));
+    memcpy(j->data + j->size + sizeof(record), data, size);
+    j->size = needed;
+    return true;
+}
+
+// makes the writes of the journal in the state file
+bool applyJournal(FILE *f, unsigned char *data, size_t size)
+{
+    size_t i = 0;
+    uint64_t record[2];
+
+    while(size - i >= sizeof(record))
+    {
+        memcpy(record, data + i, sizeof(record));
+        i += sizeof(record);
+
+        if(record[1] > size - i || !writeAt(f, record[0], data + i, record[1]))
+            return false;
+
+        i += record[1];
+    }
+
+    return i == size && fflush(f) == 0;
+}
+
+// finishes the insert that was interrupted after its journal was saved (the journal file exists then)
+bool replayJournal(state_t *st)
+{
+    char *name = suffixedName(st->filename, ".journal");
+
+    if(name == NULL)
+        return false;
+
+    FILE *f = fopen(name, "rb");
+
+    if(f == NULL)  // the last insert was finished
+    {
+        free(name);
+        return true;
+    }
+
+    off_t size = fseeko(f, 0, SEEK_END) == 0 ? ftello(f) : -1;
+    unsigned char *data = size >= 0 ? (unsigned char *) countedMalloc((size_t) size + 1) : NULL;
+    bool result = data != NULL && readAt(f, 0, data, (size_t) size) && applyJournal(st->file, data, (size_t) size);
+
+    fclose(f);
+
+    if(result)
+        remove(name);
+    else
+        fprintf(stderr, "Error! Couldn't finish the interrupted insert from the file '%s'\n", name);
+
+    free(data);
+    free(name);
+    return result;
+}
+
+// saves the journal of the insert and makes its writes in the state file, the journal file is removed then
+// the journal is written to 'STATE.journal.tmp' and renamed, so 'STATE.journal' is always complete
+bool commitJournal(state_t *st)
+{
+    char *name = suffixedName(st->filename, ".journal"), *tmp_name = suffixedName(st->filename, ".journal.tmp");
+    FILE *f = name != NULL && tmp_name != NULL ? fopen(tmp_name, "wb") : NULL;
+    bool saved = f != NULL && fwrite(st->journal.data, 1, st->journal.size, f) == st->journal.size;
+
+    if(f != NULL && fclose(f) != 0)
+        saved = false;
+
+    saved = saved && rename(tmp_name, name) == 0;
+
+    if(!saved && f != NULL)
+        remove(tmp_name);
+
+    // if the writes fail, the journal stays and the next insert makes them again
+    bool result = saved && applyJournal(st->file, st->journal.data, st->journal.size);
+
+    if(result)
+        remove(name);
+    else if(name != NULL && tmp_name != NULL)
+        fprintf(stderr, "Error! Couldn't write to the file '%s'\n", saved ? st->filename : tmp_name);
+
+    free(name);
+    free(tmp_name);
+    return result;
+}
+
+// closes the state file and frees a memory that was allocated for the state
+void closeState(state_t *st)
+{
+    if(st->file != NULL)
+        fclose(st->file);
+
+    free(st->sum_x);
+    free(st->sum_y);
+    free(st->count);
+    free(st->centroids);
+    free(st->journal.data);
+    *st = (state_t) {0};
+}
+
+// opens the state file and reads its header and the k-means clusters, an interrupted insert is finished first
+bool openState(state_t *st, char *filename)
+{
+    *st = (state_t) {.file = fopen(filename, "r+b"), .filename = filename};
+
+    if(st->file == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't open a file '%s'\n", filename);
+        return false;
+    }
+
+    if(!replayJournal(st))
+    {
+        closeState(st);
+        return false;
+    }
+
+    off_t end = fseeko(st->file, 0, SEEK_END) == 0 ? ftello(st->file) : -1;
+    state_header_t *h = &st->header;
+
+    st->end = end > 0 ? (uint64_t) end : 0;
+
+    // all sections have to be in the file, so the offsets computed from the header can be read
+    bool result = readAt(st->file, 0, h, sizeof(state_header_t)) && memcmp(h->magic, STATE_MAGIC, 4) == 0 &&
+                  h->version == STATE_VERSION && (h->flag == 'k' || h->flag == 's') && h->clusters >= 1 &&
+                  h->clusters <= INT_MAX && h->objects <= INT_MAX && h->id_slots >= 4 &&
+                  (h->id_slots & (h->id_slots - 1)) == 0 && 2 * h->objects <= h->id_slots &&
+                  h->id_offset <= st->end && h->id_slots <= (st->end - h->id_offset) / sizeof(int32_t);
+
+    if(result && h->flag == 's')
+        result = h->objects >= 1 && h->clusters <= h->parent_capacity && h->parent_offset <= st->end &&
+                 h->parent_capacity <= (st->end - h->parent_offset) / sizeof(int32_t) && h->extra_offset <= st->end &&
+                 h->extra_count <= (st->end - h->extra_offset) / sizeof(state_extra_t) &&
+                 sizeof(state_header_t) + sizeof(int32_t) * STATE_SIDE * STATE_SIDE <= st->end;
+    else if(result)
+        result = sizeof(state_header_t) + sizeof(state_cluster_t) * h->clusters <= st->end;
+
+    if(!result)
+    {
+        fprintf(stderr, "Error! Invalid state file '%s'\n", filename);
+        closeState(st);
+        return false;
+    }
+
+    if(h->flag == 's')
+        return true;
+
+    int clusters = (int) h->clusters;
+    state_cluster_t *records = (state_cluster_t *) countedMalloc(sizeof(state_cluster_t) * clusters);
+
+    st->sum_x = (long long *) countedMalloc(sizeof(long long) * clusters);
+    st->sum_y = (long long *) countedMalloc(sizeof(long long) * clusters);
+    st->count = (int *) countedMalloc(sizeof(int) * clusters);
+    st->centroids = (obj_t *) countedMalloc(sizeof(obj_t) * clusters);
+
+    if(records == NULL || st->sum_x == NULL || st->sum_y == NULL || st->count == NULL || st->centroids == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the state of the clustering\n");
+        free(records);
+        closeState(st);
+        return false;
+    }
+
+    result = readAt(st->file, sizeof(state_header_t), records, sizeof(state_cluster_t) * clusters);
+
+    for(int i = 0; i < clusters && result; i++)
+    {
+        state_cluster_t *r = &records[i];
+
+        result = r->count >= 0 && r->count <= INT_MAX && r->sum_x >= 0 && r->sum_x <= 1000 * r->count &&
+                 r->sum_y >= 0 && r->sum_y <= 1000 * r->count;
+
+        st->sum_x[i] = r->sum_x;
+        st->sum_y[i] = r->sum_y;
+        st->count[i] = (int) r->count;
+        st->centroids[i] = (obj_t) {.id = i, .x = NAN, .y = NAN};  // empty clusters get no objects
+
+        if(result && r->count > 0)
+            updateClusterCentroid(&st->centroids[i], st->sum_x[i], st->sum_y[i], st->count[i]);
+    }
+
+    free(records);
+
+    if(!result)
+    {
+        fprintf(stderr, "Error! Invalid state file '%s'\n", filename);
+        closeState(st);
+    }
+
+    return result;
+}
+
+// checks that the ids of the new objects are not in the clustering yet and adds them to the saved hash table
+// only the slots the new ids are probed at are read, the table is read whole only when it has to grow
+bool insertIds(state_t *st, obj_t *objects, int size, bool large)
+{
+    state_header_t *h = &st->header;
+    bool grow = 2 * (h->objects + size) > h->id_slots;
+    uint64_t slots = grow ? stateSlots(h->objects + size) : h->id_slots;
+    int32_t *table = grow ? (int32_t *) countedCalloc(slots, sizeof(int32_t)) : NULL;  // grown table
+    int32_t *old = grow ? (int32_t *) countedMalloc(sizeof(int32_t) * h->id_slots) : NULL;
+    id_set_t batch = {0}, taken = {0};  // ids of the new objects, slots taken by the new ids (slot + 1)
+
+    bool result = (!grow || (table != NULL && old != NULL)) && initIdSet(&batch, size, large) &&
+                  initIdSet(&taken, size, true);
+
+    if(!result)
+        fprintf(stderr, "Error! Couldn't allocate memory for adding the objects\n");
+
+    if(result && grow)
+    {
+        result = readAt(st->file, h->id_offset, old, sizeof(int32_t) * h->id_slots);
+
+        for(uint64_t i = 0; i < h->id_slots && result; i++)
+            result = old[i] == 0 || (old[i] > 0 && putId(table, slots - 1, old[i]));
+
+        if(!result)
+            fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+    }
+
+    for(int i = 0; i < size && result; i++)
+    {
+        int32_t id = objects[i].id;
+        bool unique = isIdUnique(&batch, id);
+
+        if(unique && grow)
+            unique = putId(table, slots - 1, id);
+        else if(unique)
+        {
+            size_t slot = idSlot(id, slots - 1);
+            int32_t value = 0;
+            uint64_t probes = 0;
+
+            // a saved id is before the first empty slot, the slots taken by the new ids are empty in the file
+            while((result = ++probes <= slots && readAt(st->file, h->id_offset + sizeof(int32_t) * slot, &value,
+                                                        sizeof(int32_t))) &&
+                  value != id && (value != 0 || !isIdUnique(&taken, (long long) slot + 1)))
+                slot = (slot + 1) & (slots - 1);
+
+            if(!result)
+                fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+
+            unique = value != id;
+            result = result && (!unique || journalWrite(&st->journal, h->id_offset + sizeof(int32_t) * slot, &id,
+                                                        sizeof(int32_t)));
+        }
+
+        if(result && !unique)
+        {
+            fprintf(stderr, "Error! Object with id %d is already in the clustering\n", id);
+            result = false;
+        }
+    }
+
+    // the grown table is appended to the file, the old one isn't used anymore
+    if(result && grow)
+    {
+        h->id_offset = st->end;
+        h->id_slots = slots;
+        st->end += sizeof(int32_t) * slots;
+        result = journalWrite(&st->journal, h->id_offset, table, sizeof(int32_t) * slots);
+    }
+
+    if(result)
+        h->objects += size;
+
+    destroyIdSet(&batch);
+    destroyIdSet(&taken);
+    free(table);
+    free(old);
+    return result;
+}
+
+// adds the objects to the saved k-means clusters one by one (sequential k-means):
+// the object is assigned to the nearest centroid and the centroid moves to the mean of the objects of its cluster
+// objects that were already clustered are not assigned again, the objects aren't added if any of their ids is
+// already in the clustering
+bool insertKMeans(state_t *st, obj_t *objects, int size, bool large)
+{
+    if(!insertIds(st, objects, size, large))
+        return false;
+
+    int clusters = (int) st->header.clusters;
+
+    printf("Assignments:\n");
+
+    for(int i = 0; i < size; i++)
+    {
+        float min, second;
+        int c = findNearestCentroid(&objects[i], st->centroids, clusters, &min, &second);
+
+        if(c == -1)  // all clusters are empty
+            c = 0;
+
+        st->sum_x[c] += (long long) objects[i].x;
+        st->sum_y[c] += (long long) objects[i].y;
+        st->count[c]++;
+        updateClusterCentroid(&st->centroids[c], st->sum_x[c], st->sum_y[c], st->count[c]);
+
+        printf("%d[%g,%g]: cluster %d\n", objects[i].id, objects[i].x, objects[i].y, c);
+    }
+
+    bool result = true;
+
+    for(int i = 0; i < clusters && result; i++)
+    {
+        state_cluster_t record = {.sum_x = st->sum_x[i], .sum_y = st->sum_y[i], .count = st->count[i]};
+        result = journalWrite(&st->journal, sizeof(state_header_t) + sizeof(state_cluster_t) * i, &record,
+                              sizeof(state_cluster_t));
+    }
+
+    return result;
+}
+
+// allocates a memory for the map of the parents with 'slots' slots (power of two)
+bool initParentMap(parent_map_t *map, size_t slots)
+{
+    *map = (parent_map_t) {.mask = slots - 1};
+
+    map->label = (int *) countedMalloc(sizeof(int) * slots);
+    map->parent = (int *) countedMalloc(sizeof(int) * slots);
+    map->saved = (int *) countedMalloc(sizeof(int) * slots);
+
+    if(map->label == NULL || map->parent == NULL || map->saved == NULL)
+    {
+        free(map->label);
+        free(map->parent);
+        free(map->saved);
+        *map = (parent_map_t) {0};
+        return false;
+    }
+
+    for(size_t i = 0; i < slots; i++)
+        map->label[i] = -1;
+
+    return true;
+}
+
+// frees a memory that was allocated for the map of the parents
+void destroyParentMap(parent_map_t *map)
+{
+    free(map->label);
+    free(map->parent);
+    free(map->saved);
+    *map = (parent_map_t) {0};
+}
+
+// returns the slot of the old label in the map, the parent of the label is read from the state file when the label
+// is needed for the first time (-1 on error)
+int parentSlot(state_t *st, parent_map_t *map, int label)
+{
+    size_t slot = idSlot(label, map->mask);
+
+    while(map->label[slot] != -1 && map->label[slot] != label)
+        slot = (slot + 1) & map->mask;
+
+    if(map->label[slot] == label)
+        return (int) slot;
+
+    // the map is at most half full
+    if(2 * (size_t) (map->count + 1) > map->mask + 1)
+    {
+        parent_map_t bigger;
+
+        if(!initParentMap(&bigger, 2 * (map->mask + 1)))
+        {
+            fprintf(stderr, "Error! Couldn't allocate memory for adding the objects\n");
+            return -1;
+        }
+
+        for(size_t i = 0; i <= map->mask; i++)
+        {
+            if(map->label[i] == -1)
+                continue;
+
+            size_t j = idSlot(map->label[i], bigger.mask);
+
+            while(bigger.label[j] != -1)
+                j = (j + 1) & bigger.mask;
+
+            bigger.label[j] = map->label[i];
+            bigger.parent[j] = map->parent[i];
+            bigger.saved[j] = map->saved[i];
+        }
+
+        bigger.count = map->count;
+        destroyParentMap(map);
+        *map = bigger;
+        return parentSlot(st, map, label);
+    }
+
+    int32_t parent;
+
+    // labels are joined to the smaller labels, so the parents make no cycles
+    if(!readAt(st->file, st->header.parent_offset + sizeof(int32_t) * label, &parent, sizeof(int32_t)) ||
+       parent < 0 || parent > label)
+    {
+        fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
         return -1;
     }
 
-    return arr_size;
+    map->label[slot] = label;
+    map->parent[slot] = map->saved[slot] = parent;
+    map->count++;
+    return (int) slot;
+}
+
+// returns the pointer to the parent of the label (NULL on error)
+// labels from 'clusters' of the header up are the labels of the new objects, their parents are in 'added'
+int *labelParent(state_t *st, parent_map_t *map, int *added, int label)
+{
+    int c = (int) st->header.clusters;
+
+    if(label >= c)
+        return &added[label - c];
+
+    int slot = parentSlot(st, map, label);
+    return slot >= 0 ? &map->parent[slot] : NULL;
+}
+
+// returns the root of the set of the label (-1 on error)
+int labelRoot(state_t *st, parent_map_t *map, int *added, int label)
+{
+    int *parent;
+
+    while((parent = labelParent(st, map, added, label)) != NULL && *parent != label)
+        label = *parent;
+
+    return parent != NULL ? label : -1;
+}
+
+// joins the sets of the labels 'a' and 'b', the smaller root becomes the root of the new set
+bool joinLabels(state_t *st, parent_map_t *map, int *added, int a, int b)
+{
+    a = labelRoot(st, map, added, a);
+    b = labelRoot(st, map, added, b);
+
+    if(a < 0 || b < 0)
+        return false;
+
+    if(a != b)
+        *labelParent(st, map, added, a < b ? b : a) = a < b ? a : b;
+
+    return true;
+}
+
+// returns the position from the interval [0, STATE_SIDE - 1] nearest to the coordinate
+int clampPosition(float coordinate)
+{
+    return coordinate < 0 ? 0 : coordinate > STATE_SIDE - 1 ? STATE_SIDE - 1 : (int) coordinate;
+}
+
+// joins the set of the new object with the other labels of the position (binary search in the file)
+bool joinExtraLabels(state_t *st, parent_map_t *map, int *added, int label, int position)
+{
+    state_header_t *h = &st->header;
+    uint64_t low = 0, high = h->extra_count;
+    state_extra_t e;
+
+    // first record of the position
+    while(low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+
+        if(!readAt(st->file, h->extra_offset + sizeof(state_extra_t) * middle, &e, sizeof(state_extra_t)))
+            break;
+
+        if(e.position < position)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    bool result = low == high;
+
+    for(uint64_t i = low; i < h->extra_count && result; i++)
+    {
+        result = readAt(st->file, h->extra_offset + sizeof(state_extra_t) * i, &e, sizeof(state_extra_t)) &&
+                 e.label >= 0 && e.label < (int) h->clusters;
+
+        if(result && e.position != position)
+            break;
+
+        result = result && joinLabels(st, map, added, label, e.label);
+    }
+
+    return result;
+}
+
+// joins the set of the new object 'i' with the clusters of the saved positions that are at most the saved distance
+// far, the rows of the positions are read to 'row' or they are in 'table' if the whole table was read
+bool joinSavedPositions(state_t *st, parent_map_t *map, int *added, int i, obj_t *obj, int32_t *table, int32_t *row)
+{
+    state_header_t *h = &st->header;
+    float d = h->distance;
+    int c = (int) h->clusters;
+
+    int x0 = clampPosition(floorf(obj->x - d - GRID_EPSILON)), x1 = clampPosition(ceilf(obj->x + d + GRID_EPSILON));
+    int y0 = clampPosition(floorf(obj->y - d - GRID_EPSILON)), y1 = clampPosition(ceilf(obj->y + d + GRID_EPSILON));
+
+    for(int y = y0; y <= y1; y++)
+    {
+        int32_t *labels = table != NULL ? &table[y * STATE_SIDE + x0] : row;
+
+        if(table == NULL && !readAt(st->file, sizeof(state_header_t) + sizeof(int32_t) * (y * STATE_SIDE + x0), row,
+                                    sizeof(int32_t) * (x1 - x0 + 1)))
+        {
+            fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+            return false;
+        }
+
+        for(int x = x0; x <= x1; x++)
+        {
+            int label = labels[x - x0];
+            obj_t position = {.x = (float) x, .y = (float) y};
+
+            if(label == -1)
+                continue;
+
+            countDistances(1);
+
+            if(obj_distance(obj, &position) > d)
+                continue;
+
+            if(label < 0 || label >= c)
+            {
+                fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+                return false;
+            }
+
+            if(!joinLabels(st, map, added, c + i, label))
+                return false;
+
+            if(h->extra_count > 0 && !joinExtraLabels(st, map, added, c + i, y * STATE_SIDE + x))
+            {
+                fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+                return false;
+            }
+        }
+    }
+
+    return true;
 }
 
-// check if string contains a valid program flag
-// list of the valid flags:
-// '-c' - complete linkage
-// '-a' - average linkage
-// '-k' - k-means
-// '-s' - single linkage
-bool checkFlag(char *str, char *flag)
+// saves the parents of the new labels and of the old labels the insert joined, the parents are moved to the end
+// of the file with the double capacity if the new labels don't fit
+bool saveParents(state_t *st, parent_map_t *map, int *added, int old_clusters)
 {
-    if(strcmp(str, "-c") == 0 || strcmp(str, "-a") == 0 || strcmp(str, "-k") == 0 || strcmp(str, "-s") == 0)
+    state_header_t *h = &st->header;
+    uint64_t capacity = h->parent_capacity;
+
+    if(h->clusters > capacity)
+        capacity = 2 * (uint64_t) h->clusters;
+
+    // the saved parents are read only when they are moved, the new labels are their own parents
+    uint64_t first = capacity > h->parent_capacity ? 0 : (uint64_t) old_clusters;
+    uint64_t last = capacity > h->parent_capacity ? capacity : h->clusters;
+    int32_t *parents = (int32_t *) countedMalloc(sizeof(int32_t) * (last - first + 1));
+    bool result = parents != NULL;
+
+    if(!result)
+        fprintf(stderr, "Error! Couldn't allocate memory for adding the objects\n");
+
+    if(result && first == 0 && !readAt(st->file, h->parent_offset, parents, sizeof(int32_t) * old_clusters))
     {
-        *flag = str[1];
-        return true;
+        fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+        result = false;
     }
 
-    return false;
-}
+    for(uint64_t i = old_clusters; i < last && result; i++)
+        parents[i - first] = (int32_t) i;
 
-// ./executable filename [N] [flag]
-// parses program arguments
-// returns false if invalid argument was encountered
-// returns true if all arguments were valid
-bool parseArguments(int argc, char *argv[], arguments_t *a)
-{
-    if(argc < 2 || argc > 4)
+    if(result && first == 0)
     {
-        fprintf(stderr, "Error! Invalid number of the program arguments\n");
-        return false;
+        h->parent_offset = st->end;
+        h->parent_capacity = capacity;
+        st->end += sizeof(int32_t) * capacity;
     }
 
-    a->filename = argv[1];
-
-    //  ./executable filename
-    if(argc == 2)
-        return true;
+    if(result && last > first)
+        result = journalWrite(&st->journal, h->parent_offset + sizeof(int32_t) * first, parents,
+                              sizeof(int32_t) * (last - first));
 
-    // ./executable filename N or ./executable filename flag
-    if(argc == 3)
+    // joined labels point to their roots, so the paths in the file stay short
+    for(size_t i = 0; i <= map->mask && result; i++)
     {
-        if(checkNumber(argv[2], &a->required_clusters))
-            return true;
+        int label = map->label[i];
 
-        if(checkFlag(argv[2], &a->flag))
-            return true;
+        if(label == -1)
+            continue;
 
-        fprintf(stderr, "Error! Invalid third program argument '%s'\n", argv[2]);
-        return false;
+        int32_t root = labelRoot(st, map, added, label);
+
+        if(root != map->saved[i])
+            result = journalWrite(&st->journal, h->parent_offset + sizeof(int32_t) * label, &root, sizeof(int32_t));
     }
 
-    // if argc == 4
-    // ./executable filename N flag
-    if(!checkNumber(argv[2], &a->required_clusters))
+    free(parents);
+    return result;
+}
+
+// adds the objects to the saved single linkage clusters, the object joins all clusters that have an object
+// at most the saved distance far (the longest distance single linkage merged), otherwise it makes a new cluster
+// only the positions around the new objects and the parents of their labels are read from the state file,
+// so the clusters don't have to be made again
+bool insertSingleLinkage(state_t *st, obj_t *objects, int size, bool large)
+{
+    state_header_t *h = &st->header;
+    int c = (int) h->clusters;
+
+    if(size > INT_MAX - c)
     {
-        fprintf(stderr, "Error! Invalid third program argument '%s'\n", argv[2]);
+        fprintf(stderr, "Error! Too many clusters in the state file '%s'\n", st->filename);
         return false;
     }
 
-    if(checkFlag(argv[3], &a->flag))
-        return true;
+    if(!insertIds(st, objects, size, large))
+        return false;
 
-    fprintf(stderr, "Error! Invalid fourth program argument '%s'\n", argv[3]);
-    return false;
-}
+    // the whole table of the positions is read at once if the rows around the new objects would be longer
+    uint64_t side = h->distance >= 0 ? (uint64_t) fminf(2 * h->distance + 3, STATE_SIDE) : 0;
+    bool whole = (uint64_t) size * side * side > STATE_SIDE * STATE_SIDE;
 
-// checks if an array of integers contains a specific value
-bool containDuplicate(int *arr, int size, int value)
-{
-    for(int i = 0; i < size; i++)
-        if(arr[i] == value)
-            return true;
+    int *added = (int *) countedMalloc(sizeof(int) * size);  // parents of the labels of the new objects
+    int *fresh = (int *) countedMalloc(sizeof(int) * size);  // cluster of the set of the new objects, -1 if it has none yet
+    int *found = (int *) countedMalloc(sizeof(int) * (size + 1));  // objects found in the grid
+    int32_t *table = (int32_t *) countedMalloc(sizeof(int32_t) * (whole ? STATE_SIDE * STATE_SIDE : STATE_SIDE));
+    parent_map_t map = {0};
+    grid_t new_grid = {0};
 
-    return false;
-}
+    bool result = added != NULL && fresh != NULL && found != NULL && table != NULL && initParentMap(&map, 64) &&
+                  initGrid(&new_grid, objects, size);
 
-// on a success, returns an array with random numbers from the range [1, objects_arr_size - 1] inclusively
-// otherwise returns NULL
-int *getRandomNumbers(int arr_size, int object_arr_size)
-{
-    int *random_numbers = (int *) malloc(sizeof(int) * arr_size); // allocate memory
+    if(!result)
+        fprintf(stderr, "Error! Couldn't allocate memory for adding the objects\n");
 
-    if(random_numbers == NULL) // check if allocation was successful
+    if(result && whole && !readAt(st->file, sizeof(state_header_t), table, sizeof(int32_t) * STATE_SIDE * STATE_SIDE))
     {
-        fprintf(stderr, "Error! Couldn't allocate memory for an array of centroids ids\n");
-        return NULL;
+        fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+        result = false;
+    }
+
+    for(int i = 0; i < size && result; i++)
+    {
+        added[i] = c + i;
+        fresh[i] = -1;
+    }
+
+    // the sets don't depend on the order of the objects, so the new objects can be searched in one grid
+    for(int i = 0; i < size && result && h->distance >= 0; i++)
+    {
+        result = joinSavedPositions(st, &map, added, i, &objects[i], whole ? table : NULL, table);
+
+        int found_cnt = result ? gridRadius(&new_grid, &objects[i], h->distance, found) : 0;
+
+        for(int k = 0; k < found_cnt && result; k++)
+            result = joinLabels(st, &map, added, c + i, c + found[k]);
     }
 
-    srand(time(NULL)); // set the seed to get truly random numbers each time the program is run
+    if(result)
+        printf("Assignments:\n");
 
-    for(int i = 0; i < arr_size; )
+    // the new clusters get the labels from 'c' up, they are counted in the header after all labels of the new objects
+    // were resolved, because the labels of the new objects are from 'c' up too
+    int clusters = c;
+
+    for(int i = 0; i < size && result; i++)
     {
-        // get a random number from the range [1, object_arr_size - 1] inclusively (getting and index of object array)
-        int random_number = rand() % object_arr_size;
+        int label = labelRoot(st, &map, added, c + i);
+        int position = (int) objects[i].y * STATE_SIDE + (int) objects[i].x;
+        int32_t saved = -1;
 
-        // check if the generated random number wasn't generated before, i.e. it is unique
-        if(!containDuplicate(random_numbers, i, random_number))
+        // new objects that are not connected to any old cluster make a new cluster
+        if(label >= c)
         {
-            random_numbers[i] = random_number; // write a value to random_numbers arr
-            i++;
+            if(fresh[label - c] == -1)
+                fresh[label - c] = clusters++;
+
+            label = fresh[label - c];
+        }
+
+        if(whole)
+            saved = table[position];
+        else if(!readAt(st->file, sizeof(state_header_t) + sizeof(int32_t) * position, &saved, sizeof(int32_t)))
+        {
+            fprintf(stderr, "Error! Invalid state file '%s'\n", st->filename);
+            result = false;
         }
+
+        // the position keeps its label, objects at the same position are in the same cluster
+        if(result && saved == -1)
+            result = journalWrite(&st->journal, sizeof(state_header_t) + sizeof(int32_t) * position, &label,
+                                  sizeof(int32_t));
+
+        if(result)
+            printf("%d[%g,%g]: cluster %d\n", objects[i].id, objects[i].x, objects[i].y, label);
     }
 
-    return random_numbers; // return an array with random numbers
-}
+    if(result)
+        h->clusters = (uint32_t) clusters;
 
-// initializes centroid array
-bool initializeCentroids(obj_t **centroid_arr, int centroid_arr_size, obj_t *object_arr, int object_arr_size)
-{
-    *centroid_arr = (obj_t *) malloc(sizeof(obj_t) * centroid_arr_size); // allocate memory for centroid arr
+    // old clusters that were connected by the new objects, the smallest label stays
+    int *merged = result ? (int *) countedMalloc(sizeof(int) * (map.count + 1)) : NULL;
+    int merged_cnt = 0;
 
-    if(*centroid_arr == NULL) // check if allocation was successfully
+    if(result && merged == NULL)
     {
-        fprintf(stderr, "Error! Couldn't allocate memory for an array of centroids\n");
-        return false;
+        fprintf(stderr, "Error! Couldn't allocate memory for adding the objects\n");
+        result = false;
     }
 
-    // get an array with indexes of the objects from the object array that will become centroids
-    int *indexes = getRandomNumbers(centroid_arr_size, object_arr_size);
+    for(size_t i = 0; i <= map.mask && result; i++)
+        if(map.label[i] != -1 && map.saved[i] == map.label[i] && labelRoot(st, &map, added, map.label[i]) != map.label[i])
+            merged[merged_cnt++] = map.label[i];
 
-    if(indexes == NULL) // couldn't allocate a memory for an array of random numbers
+    if(merged_cnt > 0)
     {
-        fprintf(stderr, "Error! Couldn't allocate memory for an array of random numbers\n");
-        free(centroid_arr); // free memory that was allocated for a centroid array
-        return false;
+        qsort(merged, merged_cnt, sizeof(int), &int_sort_compar);
+        printf("Merges:\n");
     }
 
-    // copy objects that have to become centroids to centroid array
-    for(int i = 0; i < centroid_arr_size; i++)
-        (*centroid_arr)[i] = object_arr[indexes[i]];
+    for(int i = 0; i < merged_cnt; i++)
+    {
+        if(stats.enabled)
+            stats.merges++;
 
-    free(indexes); // free memory that was allocated for an array of random numbers
-    return true;
+        printf("cluster %d: merged to cluster %d\n", merged[i], labelRoot(st, &map, added, merged[i]));
+    }
+
+    result = result && saveParents(st, &map, added, c);
+
+    destroyParentMap(&map);
+    destroyGrid(&new_grid);
+    free(added);
+    free(fresh);
+    free(found);
+    free(table);
+    free(merged);
+    return result;
 }
 
-// calculates the distance between an object and every centroid from centroid array
-// returns the smallest distance
-float getMinDistance(obj_t *obj, obj_t *centroid_arr, int centroid_arr_size)
+// builds the hierarchy as one phase of the statistics
+// objects with the same coordinates are collapsed to one object if at most 'clusters' clusters will be made from
+// the hierarchy (0 if all merges are needed) and there are at least as many groups, the clusters are the same then
+// average linkage isn't collapsed, its distances are rounded differently for the clusters of different sizes
+bool buildMerges(hierarchy_t *h, cluster_context_t *ctx, int n, int stop, char flag, int clusters)
 {
-    float min = MAX_CLUSTER_DISTANCE;
+    startPhase();
 
-    for(int i = 0; i < centroid_arr_size; i++)
-    {
-        float distance = obj_distance(obj, &centroid_arr[i]);
+    duplicates_t d;
+    bool collapsed = clusters > 0 && flag != 'a' && collapseDuplicates(&d, ctx->objects, n);
+    bool result;
 
-        if(distance < min)
-            min = distance;
-    }
+    if(collapsed && clusters <= d.size)
+        result = buildHierarchy(h, ctx, d.objects, d.weight, d.size, stop, flag) && expandHierarchy(h, &d, ctx->objects, n);
+    else
+        result = buildHierarchy(h, ctx, ctx->objects, NULL, n, stop, flag);
 
-    return min;
+    if(collapsed)
+        destroyDuplicates(&d);
+
+    endPhase(PHASE_MERGES);
+
+    // single/complete/average linkage find all merges, only those until 'stop' clusters remain are used
+    if(result && stats.enabled)
+        stats.merges += n - stop;
+
+    return result;
 }
 
-// assigns an object to the cluster based on the distance to the cluster centroid
-bool assignObjectToCluster(obj_t *obj, float distance, obj_t *centroid_arr, int centroid_arr_size, cluster_t *cluster_arr)
+// divides the objects of the context into the required number of clusters
+// final clusters are the first '*arr_size' clusters of the context, the objects are in the object array
+int finalClustering(cluster_context_t *ctx, int *arr_size, arguments_t *a)
 {
-    for(int i = 0; i < centroid_arr_size; i++)
+    if(a->required_clusters > *arr_size)
+    {
+        fprintf(stderr, "Error! Third program argument %d is greater than number of the objects (%d)\n", a->required_clusters, *arr_size);
+        return -1;
+    }
+
+    if(a->flag == 'k')
     {
-        if(distance == obj_distance(obj, &centroid_arr[i]))
+        bool result;
+        startPhase();
+
+        if(a->minibatch > 0)
+            result = miniBatchKMeans(ctx->objects, *arr_size, ctx->clusters, a->required_clusters, a->seed, a->minibatch,
+                                     a->max_iter > 0 ? a->max_iter : MINIBATCH_ITERATIONS, a->tol, &ctx->pool);
+        else
         {
-            if(append_cluster(&cluster_arr[i], *obj) != NULL)
-                return true;
+            duplicates_t d;
+            bool collapsed = collapseDuplicates(&d, ctx->objects, *arr_size);
 
-            break;
+            result = kMeansClustering(ctx->objects, *arr_size, collapsed ? &d : NULL, ctx->clusters, a->required_clusters,
+                                      a->seed, a->max_iter > 0 ? a->max_iter : KMEANS_ITERATIONS, a->tol, &ctx->pool);
+
+            if(collapsed)
+                destroyDuplicates(&d);
         }
+
+        endPhase(PHASE_KMEANS);
+
+        if(!result)
+            return -1;
+
+        *arr_size = a->required_clusters;
+
+        startPhase();
+        result = a->state == NULL || saveState(a->state, ctx->clusters, *arr_size, 'k', 0.0);
+        endPhase(PHASE_OUTPUT);
+
+        return result ? 0 : -1;
     }
 
-    return false;
-}
+    // single/complete/average linkage, the linkage matrix needs all merges
+    hierarchy_t h;
 
-// shifts all objects that are to the right of this index 'idx' and decrements cluster size
-void shiftCluster(cluster_t *cluster, int idx)
-{
-    for(int i = idx; i < cluster->size - 1; i++)
-        cluster->obj[i] = cluster->obj[i + 1];
+    if(!buildMerges(&h, ctx, *arr_size, a->linkage != NULL ? 1 : a->required_clusters, a->flag,
+                    a->linkage != NULL ? 0 : a->required_clusters))
+        return -1;
 
-    (cluster->size)--;
+    startPhase();
+    bool result = a->linkage == NULL || writeLinkage(&h, a->linkage);
+    endPhase(PHASE_OUTPUT);
+
+    startPhase();
+    result = result && partitionHierarchy(&h, a->required_clusters, ctx, arr_size);
+    endPhase(PHASE_CLUSTERS);
+
+    // objects that are at most as far as the last merge of the tree are in the same cluster
+    int merges = h.size - a->required_clusters;
+
+    startPhase();
+
+    if(result && a->state != NULL)
+        result = saveState(a->state, ctx->clusters, *arr_size, 's', merges > 0 ? h.merges[merges - 1].distance : -1.0);
+
+    endPhase(PHASE_OUTPUT);
+
+    destroyHierarchy(&h);
+    return result ? 0 : -1;
 }
 
-// removes an object from the array of clusters based on object id
-void removeObjectFromClusterArr(cluster_t *cluster_arr, int cluster_arr_size, obj_t *obj)
+// prints the clusters for every number of the clusters in '--cuts', the merges are found only once
+int printCuts(cluster_context_t *ctx, int *arr_size, arguments_t *a)
 {
-    for(int i = 0; i < cluster_arr_size; i++)
+    int min_cut = *arr_size, max_cut = 1;
+
+    for(int i = 0; i < a->cut_count; i++)
     {
-        for(int j = 0; j < cluster_arr[i].size; j++)
-            if(obj->id == cluster_arr[i].obj[j].id)
-                shiftCluster(&cluster_arr[i], j);
+        if(a->cuts[i] > *arr_size)
+        {
+            fprintf(stderr, "Error! Cut %d is greater than number of the objects (%d)\n", a->cuts[i], *arr_size);
+            return -1;
+        }
+
+        if(a->cuts[i] < min_cut)
+            min_cut = a->cuts[i];
+
+        if(a->cuts[i] > max_cut)
+            max_cut = a->cuts[i];
+    }
+
+    hierarchy_t h;
+
+    if(!buildMerges(&h, ctx, *arr_size, a->linkage != NULL ? 1 : min_cut, a->flag, a->linkage != NULL ? 0 : max_cut))
+        return -1;
+
+    startPhase();
+    bool result = a->linkage == NULL || writeLinkage(&h, a->linkage);
+    endPhase(PHASE_OUTPUT);
+
+    for(int i = 0; i < a->cut_count && result; i++)
+    {
+        startPhase();
+        result = partitionHierarchy(&h, a->cuts[i], ctx, arr_size);
+        endPhase(PHASE_CLUSTERS);
+
+        result = result && writeClusters(ctx->clusters, *arr_size, 't');
     }
+
+    destroyHierarchy(&h);
+    return result ? 0 : -1;
 }
 
-// assigns every object to the cluster
-bool assignObjectsToClusters(obj_t *object_arr, int object_arr_size, cluster_t *cluster_arr, int required_clusters, obj_t *centroid_arr)
+// adds the objects of the context to the clustering saved in the state file and saves the updated clustering
+// prints the cluster of every added object
+int insertObjects(cluster_context_t *ctx, int arr_size, arguments_t *a)
 {
-    for(int i = 0; i < object_arr_size; i++)
-    {
-        float min = getMinDistance(&object_arr[i], centroid_arr, required_clusters);
+    state_t st;
 
-        obj_t obj = object_arr[i];
+    if(!openState(&st, a->state))
+        return -1;
 
-        // remove the object from the previous cluster
-        removeObjectFromClusterArr(cluster_arr, required_clusters, &obj);
+    bool result = true;
+    startPhase();
 
-        // assign the object to the new cluster
-        if(!assignObjectToCluster(&obj, min, centroid_arr, required_clusters, cluster_arr))
-        {
-            free(centroid_arr);
-            return false;
-        }
-    }
+    if(st.header.flag == 'k')
+        result = insertKMeans(&st, ctx->objects, arr_size, a->memory > 0);
+    else
+        result = insertSingleLinkage(&st, ctx->objects, arr_size, a->memory > 0);
 
-    return true;
+    endPhase(PHASE_INSERT);
+
+    startPhase();
+    result = result && journalWrite(&st.journal, 0, &st.header, sizeof(state_header_t)) && commitJournal(&st);
+    endPhase(PHASE_OUTPUT);
+
+    closeState(&st);
+    return result ? 0 : -1;
 }
 
-// updates cluster centroid
-// if centroid wasn't updates returns false, otherwise returns true
-bool updateClusterCentroid(obj_t *centroid, cluster_t *cluster)
+// prints the statistics of the run to stderr and writes them to the file as JSON (if 'filename' isn't NULL)
+bool printStats(char *filename)
 {
-    obj_t tmp = *centroid;
-    centroid->x = centroid->y = 0.0;
+    const char *names[PHASE_COUNT] = {"load", "merges", "clusters", "kmeans", "insert", "output"};
+
+    struct rusage usage;
+    long peak = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;  // KiB on Linux
+
+    fprintf(stderr, "Statistics:\n");
+
+    for(int i = 0; i < PHASE_COUNT; i++)
+        if(stats.measured[i])
+            fprintf(stderr, "phase %s: wall %.6f s, cpu %.6f s\n", names[i], stats.wall[i], stats.cpu[i]);
+
+    fprintf(stderr, "distances: %llu\nmerges: %llu\nk-means iterations: %llu\nk-means reassignments: %llu\n"
+            "allocations: %llu\npeak RSS: %ld KiB\n", stats.distances, stats.merges, stats.iterations,
+            stats.reassignments, stats.allocations, peak);
+
+    if(filename == NULL)
+        return true;
+
+    FILE *f = fopen(filename, "w");
 
-    for(int i = 0; i < cluster->size; i++)
+    if(f == NULL)
     {
-        centroid->x += cluster->obj[i].x;
-        centroid->y += cluster->obj[i].y;
+        fprintf(stderr, "Error! Couldn't open the file '%s'\n", filename);
+        return false;
     }
 
-    centroid->x /= (float) cluster->size;
-    centroid->y /= (float) cluster->size;
+    fprintf(f, "{\"phases\":{");
 
-    if(tmp.x != centroid->x || tmp.y != centroid->y)
-        return true;
+    for(int i = 0, printed = 0; i < PHASE_COUNT; i++)
+        if(stats.measured[i])
+            fprintf(f, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", printed++ ? "," : "", names[i], stats.wall[i], stats.cpu[i]);
 
-    return false;
-}
+    fprintf(f, "},\"distances\":%llu,\"merges\":%llu,\"iterations\":%llu,\"reassignments\":%llu,"
+            "\"allocations\":%llu,\"peak_rss_kib\":%ld}\n", stats.distances, stats.merges, stats.iterations,
+            stats.reassignments, stats.allocations, peak);
 
-// updates all cluster centroids
-bool updateClusterCentroids(obj_t *centroid_arr, int centroid_arr_size, cluster_t *cluster_arr)
-{
-    for(int i = 0; i < centroid_arr_size; i++)
-        if(!updateClusterCentroid(&centroid_arr[i], &cluster_arr[i]))
-            return false;
+    if(fclose(f) != 0)
+    {
+        fprintf(stderr, "Error! Couldn't write to the file '%s'\n", filename);
+        return false;
+    }
 
     return true;
 }
 
-// implementation of k-means clustering algorithm
-bool kMeansClustering(obj_t *object_arr, int object_arr_size, cluster_t *cluster_arr, int required_clusters)
+cluster_context_t *clusterCreate(int threads)
 {
-    obj_t *centroid_arr = NULL; // an array of centroids
+    if(threads < 1 || threads > MAX_THREADS)
+        return NULL;
 
-    // initialize centroids and make a first assignment of the objects to the clusters
-    if(!initializeCentroids(&centroid_arr, required_clusters, object_arr, object_arr_size) ||
-       !assignObjectsToClusters(object_arr, object_arr_size, cluster_arr, required_clusters, centroid_arr))
-        return false;
+    cluster_context_t *ctx = (cluster_context_t *) countedMalloc(sizeof(cluster_context_t));
+
+    if(ctx == NULL)
+        return NULL;
 
-    // reassign objects to centroids until centroids don't change
-    while(updateClusterCentroids(centroid_arr, required_clusters, cluster_arr))
+    *ctx = (cluster_context_t) {0};
+
+    if(!initPool(&ctx->pool, threads))
     {
-        if(!assignObjectsToClusters(object_arr, object_arr_size, cluster_arr, required_clusters, centroid_arr))
-            return false;
+        free(ctx);
+        return NULL;
     }
 
-    free(centroid_arr);
-    return true;
+    return ctx;
 }
 
-// implementation of single/complete/average linkage clustering algorithms
-bool defaultClustering(int *arr_size, int required_clusters, cluster_t *cluster_arr, distanceFunction get_distance)
+void clusterDestroy(cluster_context_t *ctx)
+{
+    if(ctx == NULL)
+        return;
+
+    destroy(ctx->clusters, ctx->cluster_capacity, ctx->objects);
+    free(ctx->labels);
+    destroyScratch(&ctx->scratch);
+    destroyPool(&ctx->pool);
+    free(ctx);
+}
+
+bool clusterSetPoints(cluster_context_t *ctx, const float *x, const float *y, int count)
 {
-    while(*arr_size != required_clusters)
+    if(count < 1)
     {
-        int c1, c2; // indexes of the clusters in the cluster array
+        fprintf(stderr, "Error! Number of the points must be a positive integer\n");
+        return false;
+    }
 
-        // get the indexes of the clusters that have to be merged
-        find_neighbours(cluster_arr, *arr_size, &c1, &c2, get_distance);
+    for(int i = 0; i < count; i++)
+    {
+        // the same objects the file can contain (NaN fails the comparisons)
+        if(!(x[i] >= 0.0 && x[i] <= 1000.0 && y[i] >= 0.0 && y[i] <= 1000.0) || x[i] != (int) x[i] || y[i] != (int) y[i])
+        {
+            fprintf(stderr, "Error! Invalid coordinates of the point no. %d\n", i);
+            return false;
+        }
+    }
 
-        // cluster with index c2 will be merged to the cluster with index c1
-        if(merge_clusters(&cluster_arr[c1], &cluster_arr[c2]) == NULL)
+    // the buffers only grow, so they are allocated again only for more points than before
+    if(count > ctx->capacity)
+    {
+        obj_t *objects = (obj_t *) countedRealloc(ctx->objects, sizeof(obj_t) * count);
+
+        if(objects != NULL)
+            ctx->objects = objects;
+
+        int *labels = (int *) countedRealloc(ctx->labels, sizeof(int) * count);
+
+        if(labels != NULL)
+            ctx->labels = labels;
+
+        if(objects == NULL || labels == NULL)
         {
-            fprintf(stderr, "Error! Couldn't merge two clusters\n");
+            fprintf(stderr, "Error! Couldn't allocate memory for the points\n");
             return false;
         }
 
-        // after merging remove cluster with index c2
-        *arr_size = remove_cluster(cluster_arr, *arr_size, c2);
+        ctx->capacity = count;
     }
 
+    // the id of every object is its index, so the labels can be found from the final clusters
+    for(int i = 0; i < count; i++)
+        ctx->objects[i] = (obj_t) {.id = i, .x = x[i], .y = y[i]};
+
+    ctx->size = count;
     return true;
 }
 
-// gets required number of clusters
-int finalClustering(int *arr_size, cluster_t *cluster_arr, distanceFunction get_distance, obj_t *object_arr, arguments_t *a)
+// makes sure that the context has at least 'count' empty clusters
+bool reserveClusters(cluster_context_t *ctx, int count)
 {
-    if(a->required_clusters > *arr_size)
+    if(count > ctx->cluster_capacity)
     {
-        fprintf(stderr, "Error! Third program argument %d is greater than number of the objects (%d)\n", a->required_clusters, *arr_size);
-        return -1;
+        cluster_t *clusters = (cluster_t *) countedRealloc(ctx->clusters, sizeof(cluster_t) * count);
+
+        if(clusters == NULL)
+            return false;
+
+        ctx->clusters = clusters;
+
+        for(int i = ctx->cluster_capacity; i < count; i++)
+            init_cluster(&clusters[i], 0);
+
+        ctx->cluster_capacity = count;
     }
 
-    if(a->flag != 'k')
+    // the clusters keep their memory from the previous run
+    for(int i = 0; i < count; i++)
+        ctx->clusters[i].size = 0;
+
+    return true;
+}
+
+bool clusterRun(cluster_context_t *ctx, char method, int clusters, unsigned long long seed)
+{
+    if(method != 's' && method != 'c' && method != 'a' && method != 'k' && method != 'w' && method != 'm')
     {
-        if(!defaultClustering(arr_size, a->required_clusters, cluster_arr, get_distance))
-            return -1;
+        fprintf(stderr, "Error! Unknown clustering method '%c'\n", method);
+        return false;
     }
-    else
+
+    if(clusters < 1 || clusters > ctx->size)
     {
-        if(!kMeansClustering(object_arr, *arr_size, cluster_arr, a->required_clusters))
-        {
-            *arr_size = a->required_clusters; // need to free only 'required_clusters' clusters
-            return -1;
-        }
+        fprintf(stderr, "Error! Number of the clusters must be an integer from the interval [1, %d]\n", ctx->size);
+        return false;
+    }
 
-        *arr_size = a->required_clusters;
+    arguments_t a = {.flag = method, .required_clusters = clusters, .seed = seed, .threads = ctx->pool.threads};
+    int n = ctx->size, arr_size = n;
+
+    if(!reserveClusters(ctx, clusters))
+    {
+        fprintf(stderr, "Error! Couldn't allocate memory for the clusters\n");
+        return false;
     }
 
-    print_clusters(cluster_arr, *arr_size);
-    return 0;
+    // the temporary arrays of the algorithms are the blocks of the context, all of them are free before the run
+    for(int i = 0; i < SCRATCH_BLOCKS; i++)
+        ctx->scratch.busy[i] = false;
+
+    ctx->scratch.used = 0;
+    pthread_once(&key_once, createKeys);
+    pthread_setspecific(scratch_key, &ctx->scratch);
+
+    bool result = finalClustering(ctx, &arr_size, &a) == 0;
+
+    pthread_setspecific(scratch_key, NULL);
+
+    if(!result)
+        return false;
+
+    for(int i = 0; i < arr_size; i++)
+        for(int j = 0; j < ctx->clusters[i].size; j++)
+            ctx->labels[ctx->clusters[i].obj[j].id] = i;
+
+    return true;
 }
 
-int main(int argc, char *argv[])
+const int *clusterLabels(cluster_context_t *ctx)
 {
-    cluster_t *cluster_arr = NULL; // an array of clusters
-    obj_t *object_arr = NULL; // an array of objects (for k-means clustering)
+    return ctx->labels;
+}
 
-    arguments_t a = {.required_clusters = 1, .flag = 's'}; // program arguments
+#ifndef CLUSTER_LIBRARY
+int main(int argc, char *argv[])
+{
+    arguments_t a = {.required_clusters = 1, .flag = 's', .seed = (unsigned long long) time(NULL), .threads = 1,
+                     .format = 't'}; // program arguments
 
     if(!parseArguments(argc, argv, &a))
         return -1;
 
-    // in the case when program performs k-means clustering, arr_size represents number of the objects
-    // in the object_arr
-    // otherwise it represents number of the clusters
-    int arr_size = load_clusters( &cluster_arr, &object_arr, &a);
+    stats.enabled = a.stats;
+
+    cluster_context_t *ctx = clusterCreate(a.threads); // threads and arrays of the objects/clusters
+
+    if(ctx == NULL)
+    {
+        fprintf(stderr, "Error! Couldn't start %d threads\n", a.threads);
+        return -1;
+    }
+
+    // arr_size represents number of the objects in the object array
+    startPhase();
+    int arr_size = load_clusters(&ctx->clusters, &ctx->objects, &a);
+    endPhase(PHASE_LOAD);
 
     if(arr_size == -1)
+    {
+        clusterDestroy(ctx);
         return -1;
+    }
+
+    ctx->size = arr_size;
+    ctx->cluster_capacity = a.required_clusters;
 
-    distanceFunction get_distance = NULL;
+    int result;
 
-    if(a.flag == 's') // single linkage
-        get_distance = cluster_distance_single;
-    else if(a.flag == 'c') // complete linkage
-        get_distance = cluster_distance_complete;
-    else if(a.flag == 'a') // average linkage
-        get_distance = cluster_distance_average;
+    if(a.output != NULL)
+    {
+        startPhase();
+        result = writeBinaryFile(a.output, ctx->objects, arr_size) ? 0 : -1;
+        endPhase(PHASE_OUTPUT);
+    }
+    else if(a.insert)
+        result = insertObjects(ctx, arr_size, &a);
+    else if(a.cut_count > 0)
+        result = printCuts(ctx, &arr_size, &a);
+    else if((result = finalClustering(ctx, &arr_size, &a)) == 0)
+        result = writeClusters(ctx->clusters, arr_size, a.format) ? 0 : -1;
 
-    int result = finalClustering(&arr_size, cluster_arr, get_distance, object_arr, &a);
+    if(a.stats && !printStats(a.stats_file))
+        result = -1;
 
-    destroy(cluster_arr, arr_size, object_arr);
+    clusterDestroy(ctx);
     return result;
 }
+#endif // CLUSTER_LIBRARY
@@ -0,0 +1,54 @@
+// File: cluster.h
+// Subject: IZP
+// Project: #2
+// Author: Andrii Klymenko, FIT VUT
+// Login: xklyme00
+// Date: 22.7.2023
+
+// library interface of the cluster analysis (libcluster)
+// the context keeps the threads, the buffers of the points and the clusters and the temporary arrays of the algorithms
+// between the runs, so they are not created again for every run (the buffers only grow, they are freed by clusterDestroy)
+//
+// static library:
+//   gcc -std=c99 -Wall -Wextra -Werror -DNDEBUG -DCLUSTER_LIBRARY -c cluster.c -o cluster.o
+//   ar rcs libcluster.a cluster.o
+// shared library:
+//   gcc -std=c99 -Wall -Wextra -Werror -DNDEBUG -DCLUSTER_LIBRARY -fPIC -shared cluster.c -o libcluster.so -lm
+// programs using the library are linked with -lcluster -lm (and -pthread with glibc older than 2.34)
+// bench/library.sh builds the shared library and checks it against the program
+// only the functions declared here are exported from the shared library, the rest of cluster.c is hidden
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+
+// functions of the library interface stay visible, cluster.c hides all other symbols in the library build
+#ifdef __GNUC__
+#define CLUSTER_API __attribute__((visibility("default")))
+#else
+#define CLUSTER_API
+#endif
+
+typedef struct cluster_context_t cluster_context_t;
+
+// creates a context that runs the clustering algorithms with 'threads' threads (from 1 to 256)
+// returns NULL if the context couldn't be created
+CLUSTER_API cluster_context_t *clusterCreate(int threads);
+
+// frees the context and all its buffers
+CLUSTER_API void clusterDestroy(cluster_context_t *ctx);
+
+// copies 'count' points to the context, coordinates must be integers from the interval [0, 1000]
+CLUSTER_API bool clusterSetPoints(cluster_context_t *ctx, const float *x, const float *y, int count);
+
+// divides the points into 'clusters' clusters
+// method: 's' - single linkage, 'c' - complete linkage, 'a' - average linkage, 'w' - Ward linkage,
+//         'm' - centroid linkage, 'k' - k-means (uses the seed)
+CLUSTER_API bool clusterRun(cluster_context_t *ctx, char method, int clusters, unsigned long long seed);
+
+// returns the cluster of every point after the last successful run, the array is valid until the next call
+// hierarchical clusters are numbered in the order of their first points, k-means clusters by their centroids
+CLUSTER_API const int *clusterLabels(cluster_context_t *ctx);
+
+#endif // CLUSTER_H